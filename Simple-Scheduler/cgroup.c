@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <limits.h>
+
+/*
+ * cgroup v2 backend. Every job gets its own cgroup below
+ * <our cgroup>/simple_sched.<pid>/ and is paused with cgroup.freeze
+ * instead of SIGSTOP/SIGCONT, which covers all of its threads and
+ * children. When the cpu controller is available, cpu.max caps a job at
+ * the CPUs its slots stand for and cpu.weight.nice carries its
+ * priority. Only the scheduler process uses these functions.
+ */
+
+static char base_dir[PATH_MAX];      // empty = backend not initialised
+static char own_dir[PATH_MAX];       // the cgroup we were started in
+static int own_cpu = 0;              // we enabled +cpu in own_dir and must undo it
+static int have_cpu = 0;             // cpu controller enabled for the job cgroups
+static int cpu_period_us = 100000;
+
+static int write_file(const char *path, const char *val) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = write(fd, val, strlen(val));
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+// path = dir/name, -1 when it does not fit
+static int cg_path(char *path, size_t len, const char *dir, const char *name) {
+    int n = snprintf(path, len, "%s/%s", dir, name);
+    return n < 0 || (size_t)n >= len ? -1 : 0;
+}
+
+static int cg_write(const char *dir, const char *name, const char *val) {
+    char path[PATH_MAX];
+    if (cg_path(path, sizeof(path), dir, name) < 0) return -1;
+    return write_file(path, val);
+}
+
+static int cg_move(const char *dir, pid_t pid) {
+    char val[32];
+    snprintf(val, sizeof(val), "%d", (int)pid);
+    return cg_write(dir, "cgroup.procs", val);
+}
+
+static int has_controller(const char *dir, const char *name) {
+    char path[PATH_MAX], line[256];
+    if (cg_path(path, sizeof(path), dir, "cgroup.subtree_control") < 0) return 0;
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    int found = 0;
+    if (fgets(line, sizeof(line), f)) {
+        for (char *t = strtok(line, " \n"); t; t = strtok(NULL, " \n")) {
+            if (strcmp(t, name) == 0) found = 1;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// -1 when the path does not fit
+static int job_dir(Job *j, char *buf, size_t len) {
+    int n = snprintf(buf, len, "%s/%d", base_dir, j->pid);
+    return n < 0 || (size_t)n >= len ? -1 : 0;
+}
+
+// mount point of the cgroup2 hierarchy, from /proc/self/mountinfo
+static int find_mount(char *mnt, size_t len) {
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (!f) return -1;
+
+    char line[1024];
+    int found = -1;
+    while (fgets(line, sizeof(line), f)) {
+        char *sep = strstr(line, " - ");
+        if (!sep || strncmp(sep + 3, "cgroup2 ", 8) != 0) continue;
+        char dir[512];
+        if (sscanf(line, "%*d %*d %*s %*s %511s", dir) == 1) {
+            snprintf(mnt, len, "%s", dir);
+            found = 0;
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// our own cgroup in the v2 hierarchy, the "0::<path>" line of /proc/self/cgroup
+static int find_own_cgroup(char *path, size_t len) {
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f) return -1;
+
+    char line[1024];
+    int found = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) != 0) continue;
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(path, len, "%s", strcmp(line + 3, "/") == 0 ? "" : line + 3);
+        found = 0;
+        break;
+    }
+    fclose(f);
+    return found;
+}
+
+// Controllers can only be enabled in a cgroup without processes of its
+// own (except the root). The shell and the scheduler are moved to the
+// leaf simple_sched.<pid>/self first, which empties our cgroup unless
+// other processes share it, e.g. the terminal the shell was started from.
+static void enable_cpu(void) {
+    char self[PATH_MAX];
+    if (cg_path(self, sizeof(self), base_dir, "self") < 0) return;
+    if (mkdir(self, 0755) < 0 && errno != EEXIST) return;
+    cg_move(self, getppid());
+    if (cg_move(self, getpid()) < 0) return;
+
+    if (!has_controller(own_dir, "cpu")) {
+        if (cg_write(own_dir, "cgroup.subtree_control", "+cpu") < 0) return;
+        own_cpu = 1;
+    }
+    have_cpu = cg_write(base_dir, "cgroup.subtree_control", "+cpu") == 0;
+}
+
+int cgroup_init(int tslice_ms) {
+    char mnt[512], own[512];
+    if (find_mount(mnt, sizeof(mnt)) < 0 || find_own_cgroup(own, sizeof(own)) < 0)
+        return -1;
+
+    int n = snprintf(own_dir, sizeof(own_dir), "%s%s", mnt, own);
+    int m = snprintf(base_dir, sizeof(base_dir), "%s/simple_sched.%d", own_dir, getpid());
+    if (n < 0 || (size_t)n >= sizeof(own_dir) || m < 0 || (size_t)m >= sizeof(base_dir) ||
+        (mkdir(base_dir, 0755) < 0 && errno != EEXIST)) {
+        base_dir[0] = '\0';
+        return -1;
+    }
+
+    // freezing needs no controller, the cpu controller is optional
+    enable_cpu();
+    if (have_cpu) {
+        printf("cgroup: cpu controller active, jobs are capped by cpu.max\n");
+    } else {
+        fprintf(stderr, "cgroup: cpu controller not available in %s, jobs are only frozen\n", own_dir);
+    }
+
+    // throttle in periods of one slice, within the limits of cpu.max
+    cpu_period_us = tslice_ms * 1000;
+    if (cpu_period_us < 1000) cpu_period_us = 1000;
+    if (cpu_period_us > 1000000) cpu_period_us = 1000000;
+    return 0;
+}
+
+int cgroup_has_cpu(void) {
+    return have_cpu;
+}
+
+// Undo cgroup_init(): the shell and the scheduler go back to our own
+// cgroup, which needs the cpu controller disabled again first
+void cgroup_destroy(void) {
+    if (!base_dir[0]) return;
+
+    char self[PATH_MAX];
+    if (have_cpu) cg_write(base_dir, "cgroup.subtree_control", "-cpu");
+    if (own_cpu) cg_write(own_dir, "cgroup.subtree_control", "-cpu");
+    cg_move(own_dir, getppid());
+    cg_move(own_dir, getpid());
+    if (cg_path(self, sizeof(self), base_dir, "self") == 0) rmdir(self);
+    rmdir(base_dir);
+    base_dir[0] = '\0';
+    have_cpu = own_cpu = 0;
+}
+
+// Move a new job into its own frozen cgroup. On failure the job stays
+// where it is and is controlled with signals (cg_fd = -1).
+int cgroup_attach(Job *j) {
+    char dir[PATH_MAX], path[PATH_MAX], val[64];
+
+    j->cg_fd = -1;
+    j->cg_cpus = 1;
+    if (!base_dir[0] || job_dir(j, dir, sizeof(dir)) < 0) return -1;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) return -1;
+
+    int fd = -1;
+    if (cg_path(path, sizeof(path), dir, "cgroup.freeze") == 0) fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || write(fd, "1", 1) != 1) {
+        if (fd >= 0) close(fd);
+        rmdir(dir);
+        return -1;
+    }
+
+    if (have_cpu) {
+        snprintf(val, sizeof(val), "%d %d", cpu_period_us, cpu_period_us);
+        cg_write(dir, "cpu.max", val);
+        snprintf(val, sizeof(val), "%d", j->priority);
+        cg_write(dir, "cpu.weight.nice", val);
+    }
+
+    if (cg_move(dir, j->pid) < 0) {
+        close(fd);
+        rmdir(dir);
+        return -1;
+    }
+    j->cg_fd = fd;
+    return 0;
+}
+
+// Remove the cgroup of a reaped job, leftovers of the job are killed
+void cgroup_detach(Job *j) {
+    if (j->cg_fd < 0) return;
+
+    char dir[PATH_MAX];
+    if (job_dir(j, dir, sizeof(dir)) == 0 && rmdir(dir) < 0 && errno == EBUSY) {
+        cg_write(dir, "cgroup.kill", "1");
+        write(j->cg_fd, "0", 1);
+        rmdir(dir);
+    }
+    close(j->cg_fd);
+    j->cg_fd = -1;
+}
+
+int cgroup_freeze(Job *j, int frozen) {
+    return write(j->cg_fd, frozen ? "1" : "0", 1) == 1 ? 0 : -1;
+}
+
+// a job gang-scheduled on n slots may use n CPUs per period
+void cgroup_set_cpus(Job *j, int n) {
+    if (!have_cpu || j->cg_fd < 0 || j->cg_cpus == n) return;
+
+    char dir[PATH_MAX], val[64];
+    if (job_dir(j, dir, sizeof(dir)) < 0) return;
+    snprintf(val, sizeof(val), "%d %d", n * cpu_period_us, cpu_period_us);
+    if (cg_write(dir, "cpu.max", val) == 0) j->cg_cpus = n;
+}
+
+// SIGKILL every process of the job, cgroup.kill needs Linux 5.14
+void cgroup_kill(Job *j) {
+    char dir[PATH_MAX];
+    if (job_dir(j, dir, sizeof(dir)) < 0 || cg_write(dir, "cgroup.kill", "1") < 0)
+        kill(j->pid, SIGKILL);
+}
+
+// CPU time of the whole job (all threads and children) from cpu.stat
+long long cgroup_cpu_ns(Job *j) {
+    char dir[PATH_MAX], path[PATH_MAX];
+    if (job_dir(j, dir, sizeof(dir)) < 0 || cg_path(path, sizeof(path), dir, "cpu.stat") < 0)
+        return -1;
+
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    long long usec = -1;
+    if (fscanf(f, "usage_usec %lld", &usec) != 1) usec = -1;
+    fclose(f);
+    return usec < 0 ? -1 : usec * 1000;
+}
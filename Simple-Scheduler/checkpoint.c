@@ -0,0 +1,160 @@
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/*
+ * Checkpoint files and the restore manifest. A job that registered its
+ * state through dummy_main.h saves it to <dir>/<key>.ckpt when the
+ * scheduler shuts down; the scheduler then lists the job in
+ * <dir>/manifest, one line in submit syntax with -r <key>, together with
+ * the jobs that never started, and the next shell submits these lines
+ * again. Keys are "<session>-<id>", the
+ * session is new for every shell start, so files never collide.
+ */
+
+void checkpoint_init(SharedState *S) {
+    const char *dir = getenv("SCHED_CHECKPOINT_DIR");
+    if (!dir || !*dir) dir = ".sched_checkpoint";
+
+    // jobs may change directory, give them an absolute path
+    char cwd[200];
+    if (dir[0] != '/' && getcwd(cwd, sizeof(cwd))) {
+        snprintf(S->ckpt_dir, sizeof(S->ckpt_dir), "%s/%s", cwd, dir);
+    } else {
+        snprintf(S->ckpt_dir, sizeof(S->ckpt_dir), "%s", dir);
+    }
+    snprintf(S->session, sizeof(S->session), "%lx.%x", (long)time(NULL), (unsigned)getpid());
+}
+
+void checkpoint_key(SharedState *S, int id, char *key) {
+    snprintf(key, CKPT_KEY_LEN, "%s-%d", S->session, id);
+}
+
+void checkpoint_path(SharedState *S, const char *key, char *buf, size_t len) {
+    snprintf(buf, len, "%s/%s.ckpt", S->ckpt_dir, key);
+}
+
+void checkpoint_manifest(SharedState *S, char *buf, size_t len) {
+    snprintf(buf, len, "%s/manifest", S->ckpt_dir);
+}
+
+typedef struct {
+    int id, idx;
+    int line;   // line of the manifest it was written to, -1 = not written
+} SavedJob;
+
+// one word of a manifest line, quoted when parse_command() would split
+// it or drop characters from it
+static void put_word(FILE *f, const char *s) {
+    if (*s && !strpbrk(s, " \t\"\\")) {
+        fputs(s, f);
+        return;
+    }
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static int cmp_saved(const void *a, const void *b) {
+    return ((const SavedJob *)a)->id - ((const SavedJob *)b)->id;
+}
+
+// checkpoint key the job resumes from, "" for a fresh start; 0 when the
+// job is not submitted again
+static int resume_key(SharedState *S, Job *j, char *key) {
+    key[0] = '\0';
+    if (j->state != DONE) return 0;
+    if (j->exit_status == EXIT_CHECKPOINTED) {
+        checkpoint_key(S, j->id, key);
+        return 1;
+    }
+    if (j->exit_status != EXIT_KILLED) return 0;
+    if (j->restore[0]) {
+        snprintf(key, CKPT_KEY_LEN, "%s", j->restore);
+        return 1;
+    }
+    return !j->started;
+}
+
+// After the jobs were stopped, write every job that can go on to the
+// manifest: a job that saved a checkpoint resumes from it, one killed
+// before it could save from the checkpoint it was restored from, and one
+// that never started (ready or blocked) starts from the beginning. The
+// manifest is submitted as one batch with consecutive ids, so lines are
+// written in id order and dependencies become relative ("after -N").
+int checkpoint_save(SharedState *S) {
+    SavedJob *saved = malloc((S->job_count + 1) * sizeof(SavedJob));
+    if (!saved) {
+        perror("malloc");
+        return 0;
+    }
+    int nsaved = 0;
+    for (int i = 0; i < S->job_count; i++) {
+        char key[CKPT_KEY_LEN];
+        Job *j = get_job(S, i);
+        if (!resume_key(S, j, key)) continue;
+        saved[nsaved].id = j->id;
+        saved[nsaved].idx = i;
+        saved[nsaved].line = -1;
+        nsaved++;
+    }
+    qsort(saved, nsaved, sizeof(SavedJob), cmp_saved);
+
+    char path[300];
+    FILE *f = NULL;
+    int n = 0;
+
+    for (int k = 0; k < nsaved; k++) {
+        Job *j = get_job(S, saved[k].idx);
+        char key[CKPT_KEY_LEN];
+        resume_key(S, j, key);
+
+        // predecessors that have not succeeded must be in the manifest too
+        char after[MAX_DEPS * 12 + 8] = "";
+        int alen = 0, lost = 0;
+        for (int d = 0; d < j->nafter && !lost; d++) {
+            if (deps_succeeded(j->after[d])) continue;
+            SavedJob want = { j->after[d], 0, 0 };
+            SavedJob *p = bsearch(&want, saved, k, sizeof(SavedJob), cmp_saved);
+            if (!p || p->line < 0) {
+                fprintf(stderr, "job %d not restorable, job %d it waits for is lost\n", j->id, j->after[d]);
+                lost = 1;
+                break;
+            }
+            alen += snprintf(after + alen, sizeof(after) - alen, "%s-%d", alen ? "," : " after ", n - p->line);
+        }
+        if (lost) continue;
+
+        if (!f) {
+            checkpoint_manifest(S, path, sizeof(path));
+            f = fopen(path, "a");
+            if (!f) {
+                perror(path);
+                free(saved);
+                return 0;
+            }
+        }
+
+        if (key[0]) fprintf(f, "-r %s ", key);
+        if (j->quantum) fprintf(f, "-q %d ", j->quantum);
+        if (j->threads_req) fprintf(f, "-t %d ", j->threads_req);
+        put_word(f, j->path);
+        fprintf(f, " %d%s --", j->priority, after);
+        const char *a = j->args;
+        for (int i = 0; i < j->nargs; i++, a += strlen(a) + 1) {
+            fputc(' ', f);
+            put_word(f, a);
+        }
+        fputc('\n', f);
+        saved[k].line = n++;
+    }
+    if (f) fclose(f);
+    free(saved);
+    return n;
+}
@@ -4,23 +4,27 @@
 #include "dummy_main.h"
 
 int main(int argc, char **argv) {
-    
-    volatile unsigned long long sum = 0;
-    printf("Job with PID %d has started its long computation.\n", getpid());
 
-    for (unsigned long long i = 0; i < 2000000000ULL; i++) {
-        sum += i;
-    }
-    for (unsigned long long i = 0; i < 2000000000ULL; i++) {
-        sum += i;
-    }
-    for (unsigned long long i = 0; i < 2000000000ULL; i++) {
-        sum += i;
+    // all progress lives here, so the job can be checkpointed
+    struct {
+        int loop;
+        unsigned long long i, sum;
+    } st = { 0, 0, 0 };
+
+    if (sched_checkpoint_register(&st, sizeof(st)) == 1) {
+        printf("Job with PID %d resumed its long computation at loop %d.\n", getpid(), st.loop);
+    } else {
+        printf("Job with PID %d has started its long computation.\n", getpid());
     }
-    for (unsigned long long i = 0; i < 2000000000ULL; i++) {
-        sum += i;
+
+    for (; st.loop < 4; st.loop++, st.i = 0) {
+        for (; st.i < 2000000000ULL; st.i++) {
+            st.sum += st.i;
+            if ((st.i & 0xffffff) == 0) sched_checkpoint_point();
+        }
     }
     printf("Job with PID %d finished its computation.\n", getpid());
+    sched_result_printf("sum=%llu", st.sum);
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,142 @@
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Job dependencies, kept by the scheduler only. Jobs are named by the id
+ * the submitter gave them (job slots are recycled, ids are not). Every id
+ * has a list of the jobs waiting for it; a dependent only ever names
+ * smaller ids, so the graph cannot have cycles.
+ */
+
+#define ID_PENDING 0
+#define ID_OK      1
+#define ID_FAILED  2
+
+typedef struct {
+    int dependent;         // id of the waiting job
+    int next;              // next edge of the same predecessor, -1 = end
+} Edge;
+
+static int *id_slot = NULL;      // job slot of a live id, -1 once it ended
+static char *id_status = NULL;   // ID_PENDING, ID_OK or ID_FAILED
+static int *id_edges = NULL;     // first edge of every id, -1 = none
+static int id_cap = 0;
+
+static Edge *edges = NULL;
+static int nr_edges = 0, edge_cap = 0;
+
+static void grow_ids(int id) {
+    if (id < id_cap) return;
+    int cap = id_cap ? id_cap : 256;
+    while (cap <= id) cap *= 2;
+
+    id_slot = realloc(id_slot, cap * sizeof(int));
+    id_status = realloc(id_status, cap);
+    id_edges = realloc(id_edges, cap * sizeof(int));
+    if (!id_slot || !id_status || !id_edges) {
+        perror("realloc");
+        exit(1);
+    }
+    for (int i = id_cap; i < cap; i++) {
+        id_slot[i] = -1;
+        id_status[i] = ID_PENDING;
+        id_edges[i] = -1;
+    }
+    id_cap = cap;
+}
+
+static void add_edge(int pred, int dependent) {
+    if (nr_edges == edge_cap) {
+        edge_cap = edge_cap ? edge_cap * 2 : 256;
+        edges = realloc(edges, edge_cap * sizeof(Edge));
+        if (!edges) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    edges[nr_edges].dependent = dependent;
+    edges[nr_edges].next = id_edges[pred];
+    id_edges[pred] = nr_edges++;
+}
+
+// A new job with the given predecessors. Sets j->deps_left and returns
+// it, or -1 when a predecessor has already failed.
+int deps_add(SharedState *S, int idx, const int *after, int n) {
+    Job *j = get_job(S, idx);
+    grow_ids(j->id);
+    id_slot[j->id] = idx;
+    j->deps_left = 0;
+
+    for (int i = 0; i < n; i++) {
+        int pred = after[i];
+        if (pred < 1 || pred >= j->id) continue;   // checked by the submitter
+        grow_ids(pred);
+        if (id_status[pred] == ID_FAILED) return -1;
+        if (id_status[pred] == ID_OK) continue;
+        add_edge(pred, j->id);
+        j->deps_left++;
+    }
+    return j->deps_left;
+}
+
+// Job id ended. Dependents whose last predecessor succeeded are passed
+// to release(); when it failed, every job downstream of it that has not
+// started yet is passed to cancel(), depth first.
+static void id_done(SharedState *S, int id, int ok, void (*release)(int idx), void (*cancel)(int idx)) {
+    if (id < 1) return;
+    grow_ids(id);
+    if (id_status[id] != ID_PENDING) return;
+
+    id_status[id] = ok ? ID_OK : ID_FAILED;
+    id_slot[id] = -1;
+
+    if (ok) {
+        for (int e = id_edges[id]; e != -1; e = edges[e].next) {
+            int dep = edges[e].dependent;
+            if (id_slot[dep] == -1 || id_status[dep] != ID_PENDING) continue;
+            if (--get_job(S, id_slot[dep])->deps_left == 0) release(id_slot[dep]);
+        }
+        return;
+    }
+
+    // failures cascade, walk the graph with an explicit stack
+    int *stack = NULL, top = 0, cap = 0;
+    int cur = id;
+    for (;;) {
+        for (int e = id_edges[cur]; e != -1; e = edges[e].next) {
+            int dep = edges[e].dependent;
+            if (id_status[dep] != ID_PENDING) continue;
+            id_status[dep] = ID_FAILED;
+            if (id_slot[dep] != -1) cancel(id_slot[dep]);
+            id_slot[dep] = -1;
+            if (top == cap) {
+                cap = cap ? cap * 2 : 64;
+                stack = realloc(stack, cap * sizeof(int));
+                if (!stack) {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            stack[top++] = dep;
+        }
+        if (top == 0) break;
+        cur = stack[--top];
+    }
+    free(stack);
+}
+
+void deps_done(SharedState *S, int idx, int ok, void (*release)(int idx), void (*cancel)(int idx)) {
+    id_done(S, get_job(S, idx)->id, ok, release, cancel);
+}
+
+// An id that never became a job (rejected by the submitter or no job
+// slot for it) counts as failed, so its dependents don't wait forever
+void deps_drop(SharedState *S, int id, void (*cancel)(int idx)) {
+    id_done(S, id, 0, NULL, cancel);
+}
+
+// 1 if job id ended successfully, so jobs waiting for it need not any more
+int deps_succeeded(int id) {
+    return id > 0 && id < id_cap && id_status[id] == ID_OK;
+}
@@ -1,15 +1,146 @@
 #include <signal.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "job_result.h"
+
+// this job's result slot, NULL when it was not started by the scheduler
+static JobResult *sched_result = NULL;
+
+// checkpoint files from the scheduler, and the state registered for them
+static char sched_ckpt_file[300];
+static char sched_restore_file[300];
+static void *sched_ckpt_state = NULL;
+static size_t sched_ckpt_len = 0;
+
+// map the slot the scheduler passed in the environment
+static void sched_result_map(void) {
+    const char *fd = getenv("SCHED_RESULT_FD");
+    const char *off = getenv("SCHED_RESULT_OFFSET");
+    if (!fd || !off) return;
+
+    const char *ckpt = getenv("SCHED_CHECKPOINT_FILE");
+    const char *restore = getenv("SCHED_RESTORE_FILE");
+    if (ckpt) snprintf(sched_ckpt_file, sizeof(sched_ckpt_file), "%s", ckpt);
+    if (restore) snprintf(sched_restore_file, sizeof(sched_restore_file), "%s", restore);
+
+    long page = sysconf(_SC_PAGESIZE);
+    long long offset = atoll(off);
+    long long base = offset & ~(long long)(page - 1);
+    char *m = mmap(NULL, offset - base + sizeof(JobResult), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, atoi(fd), base);
+    if (m != MAP_FAILED) sched_result = (JobResult *)(m + (offset - base));
+    close(atoi(fd));
+    // programs this job starts must not write to the slot
+    unsetenv("SCHED_RESULT_FD");
+    unsetenv("SCHED_RESULT_OFFSET");
+    unsetenv("SCHED_CHECKPOINT_FILE");
+    unsetenv("SCHED_RESTORE_FILE");
+}
+
+// Replace the job's result, read by the shell with `result <id>`. Data
+// past RESULT_MAX bytes is dropped. Returns the bytes stored, -1 when
+// the job is not run by the scheduler. Call from one thread at a time.
+static inline int sched_result_set(const void *data, size_t len) {
+    if (!sched_result) return -1;
+    if (len > (size_t)RESULT_MAX) len = RESULT_MAX;
+
+    unsigned seq = atomic_load_explicit(&sched_result->seq, memory_order_relaxed);
+    atomic_store_explicit(&sched_result->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(sched_result->data, data, len);
+    sched_result->len = len;
+    atomic_store_explicit(&sched_result->seq, seq + 2, memory_order_release);
+    return len;
+}
+
+static inline int sched_result_printf(const char *fmt, ...) {
+    char buf[RESULT_MAX + 1];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    return sched_result_set(buf, n < RESULT_MAX ? n : RESULT_MAX);
+}
+
+// Register the len bytes at state as the job's progress. When the
+// scheduler shuts down, sched_checkpoint_point() saves them and the job
+// is started again at the next start; this call then loads them back.
+// Returns 1 if state was restored, 0 for a fresh start and -1 when the
+// job is not run by the scheduler. Call once, early in main.
+static inline int sched_checkpoint_register(void *state, size_t len) {
+    if (!sched_result || !sched_ckpt_file[0]) return -1;
+    sched_ckpt_state = state;
+    sched_ckpt_len = len;
+
+    int restored = 0;
+    if (sched_restore_file[0]) {
+        FILE *f = fopen(sched_restore_file, "rb");
+        CheckpointHeader h;
+        char *buf = malloc(len ? len : 1);
+        if (f && buf && fread(&h, sizeof(h), 1, f) == 1 && h.magic == CHECKPOINT_MAGIC &&
+            h.len == len && fread(buf, 1, len, f) == len) {
+            memcpy(state, buf, len);
+            restored = 1;
+        } else {
+            fprintf(stderr, "checkpoint %s not usable, starting over\n", sched_restore_file);
+        }
+        free(buf);
+        if (f) fclose(f);
+    }
+
+    int expected = CKPT_NONE;
+    atomic_compare_exchange_strong(&sched_result->checkpoint, &expected, CKPT_READY);
+    return restored;
+}
+
+// Call where the registered state is consistent, e.g. once per outer
+// loop iteration; it only loads a flag. When the scheduler is shutting
+// down it writes the checkpoint and exits with CHECKPOINT_EXIT.
+static inline void sched_checkpoint_point(void) {
+    if (!sched_ckpt_state ||
+        atomic_load_explicit(&sched_result->checkpoint, memory_order_relaxed) != CKPT_REQUESTED)
+        return;
+
+    char tmp[310];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", sched_ckpt_file);
+    CheckpointHeader h = { CHECKPOINT_MAGIC, 0, sched_ckpt_len };
+    FILE *f = fopen(tmp, "wb");
+    if (!f || fwrite(&h, sizeof(h), 1, f) != 1 ||
+        fwrite(sched_ckpt_state, 1, sched_ckpt_len, f) != sched_ckpt_len ||
+        fflush(f) != 0 || fsync(fileno(f)) < 0) {
+        perror("checkpoint");
+        if (f) fclose(f);
+        unlink(tmp);
+        exit(1);
+    }
+    fclose(f);
+    // a crash while writing leaves the previous checkpoint intact
+    if (rename(tmp, sched_ckpt_file) < 0) {
+        perror("checkpoint");
+        unlink(tmp);
+        exit(1);
+    }
+    exit(CHECKPOINT_EXIT);
+}
 
 int dummy_main(int argc, char **argv);
 
 int main(int argc, char **argv) {
-    // stop immediately so scheduler can control execution
-    raise(SIGSTOP);
+    sched_result_map();
+
+    // stop immediately so scheduler can control execution; a job started
+    // by the scheduler was already stopped before exec
+    if (!getenv("SCHED_STOPPED")) raise(SIGSTOP);
+    unsetenv("SCHED_STOPPED");
 
     int ret = dummy_main(argc, argv);
     return ret;
 }
 
 #define main dummy_main
-
@@ -0,0 +1,44 @@
+#ifndef JOB_RESULT_H
+#define JOB_RESULT_H
+
+#include <stdatomic.h>
+
+/*
+ * Result slot of a job: a small buffer in shared memory the job writes
+ * through dummy_main.h and the shell reads with `result <id>`. The job
+ * writes a page of its own; the scheduler copies it to the job's slot in
+ * a memfd next to the job table, one slot per job table entry. The job's
+ * page also carries the checkpoint handshake between the scheduler and
+ * the job.
+ */
+
+#define RESULT_SLOT_SIZE 4096   // one page, the size of a job's own memfd
+
+// JobResult.checkpoint
+#define CKPT_NONE      0   // the job registered no checkpoint state
+#define CKPT_READY     1   // sched_checkpoint_register() was called
+#define CKPT_REQUESTED 2   // scheduler is shutting down: save and exit
+
+#define CHECKPOINT_EXIT 75      // exit code of a job that saved its checkpoint
+#define CHECKPOINT_MAGIC 0x534b5054u
+
+typedef struct {
+    int id;                // job the slot belongs to, set by the scheduler
+    atomic_uint seq;       // seqlock: odd while the job is writing
+    unsigned len;          // bytes in data
+    atomic_int checkpoint; // CKPT_NONE, CKPT_READY or CKPT_REQUESTED
+    char data[RESULT_SLOT_SIZE - 16];
+} JobResult;
+
+// header of a checkpoint file, the registered state follows
+typedef struct {
+    unsigned magic;
+    unsigned pad;
+    unsigned long long len;
+} CheckpointHeader;
+
+#define RESULT_MAX ((int)sizeof(((JobResult *)0)->data))
+
+_Static_assert(sizeof(JobResult) == RESULT_SLOT_SIZE, "JobResult must fill its slot");
+
+#endif
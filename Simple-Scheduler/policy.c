@@ -0,0 +1,293 @@
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Ready queue policies. They only move job slots between the run queues
+ * and never touch processes, the scheduler decides when to stop and
+ * resume jobs. There is one run queue per scheduler slot; new jobs are
+ * spread over them, idle slots steal and the scheduler rebalances them
+ * every BALANCE_SLICES.
+ */
+
+// CFS weights for nice -20..19, same table as the Linux kernel
+static const int prio_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15,
+};
+#define NICE_0_WEIGHT 1024
+
+// priorities up to the default 0 start at the top level, 1..PRIO_MAX are
+// spread evenly over the levels below it
+static int base_level(Job *j) {
+    if (j->priority <= 0) return 0;
+    return 1 + (j->priority - 1) * (MLFQ_LEVELS - 1) / PRIO_MAX;
+}
+
+// POLICY_CFS: binary min-heap of job slots keyed by vruntime
+static int heap_less(SharedState *S, RunQueue *rq, int a, int b) {
+    return get_job(S, rq->heap[a])->vruntime < get_job(S, rq->heap[b])->vruntime;
+}
+
+static void heap_swap(RunQueue *rq, int a, int b) {
+    int t = rq->heap[a];
+    rq->heap[a] = rq->heap[b];
+    rq->heap[b] = t;
+}
+
+static void heap_push(SharedState *S, RunQueue *rq, int idx) {
+    if (rq->heap_size == rq->heap_cap) {
+        rq->heap_cap = rq->heap_cap ? rq->heap_cap * 2 : 64;
+        rq->heap = realloc(rq->heap, rq->heap_cap * sizeof(int));
+        if (!rq->heap) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    int i = rq->heap_size++;
+    rq->heap[i] = idx;
+    while (i > 0 && heap_less(S, rq, i, (i - 1) / 2)) {
+        heap_swap(rq, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static int heap_pop(SharedState *S, RunQueue *rq) {
+    if (rq->heap_size == 0) return -1;
+    int top = rq->heap[0];
+    rq->heap[0] = rq->heap[--rq->heap_size];
+
+    int i = 0;
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, min = i;
+        if (l < rq->heap_size && heap_less(S, rq, l, min)) min = l;
+        if (r < rq->heap_size && heap_less(S, rq, r, min)) min = r;
+        if (min == i) break;
+        heap_swap(rq, i, min);
+        i = min;
+    }
+    return top;
+}
+
+void policy_init(SharedState *S, int policy, int adaptive, int ncpu, int tslice_ms) {
+    S->policy = policy;
+    S->adaptive = adaptive;
+    S->ncpu = ncpu;
+    S->tslice_ms = tslice_ms;
+    S->nr_ready = 0;
+    S->last_boost = 0;
+    // fixed seed so every run, and every policy of a simulation, places alike
+    S->place_rng = 2463534242u;
+}
+
+void runqueue_init(RunQueue *rq) {
+    rq->nr_ready = 0;
+    rq->heap = NULL;
+    rq->heap_cap = 0;
+    queue_init(&rq->ready_q);
+    for (int l = 0; l < MLFQ_LEVELS; l++) {
+        queue_init(&rq->level_q[l]);
+    }
+    rq->heap_size = 0;
+    rq->min_vruntime = 0;
+}
+
+void runqueue_destroy(RunQueue *rq) {
+    free(rq->heap);
+    rq->heap = NULL;
+    rq->heap_cap = rq->heap_size = 0;
+}
+
+const char *policy_name(int policy) {
+    switch (policy) {
+    case POLICY_MLFQ: return "mlfq";
+    case POLICY_CFS:  return "cfs";
+    default:          return "rr";
+    }
+}
+
+int policy_from_name(const char *name) {
+    if (strcmp(name, "rr") == 0) return POLICY_RR;
+    if (strcmp(name, "mlfq") == 0) return POLICY_MLFQ;
+    if (strcmp(name, "cfs") == 0) return POLICY_CFS;
+    return -1;
+}
+
+// a new or preempted job becomes ready on rq
+void enqueue(SharedState *S, RunQueue *rq, int idx) {
+    Job *j = get_job(S, idx);
+
+    if (S->policy == POLICY_MLFQ) {
+        queue_push(S, &rq->level_q[j->level], idx);
+    } else if (S->policy == POLICY_CFS) {
+        heap_push(S, rq, idx);
+    } else {
+        queue_push(S, &rq->ready_q, idx);
+    }
+    rq->nr_ready++;
+    S->nr_ready++;
+}
+
+// next job to run from rq, -1 if nothing is ready there
+int dequeue(SharedState *S, RunQueue *rq) {
+    int idx = -1;
+
+    if (S->policy == POLICY_MLFQ) {
+        for (int l = 0; l < MLFQ_LEVELS && idx == -1; l++) {
+            idx = queue_pop(S, &rq->level_q[l]);
+        }
+    } else if (S->policy == POLICY_CFS) {
+        idx = heap_pop(S, rq);
+        if (idx != -1 && get_job(S, idx)->vruntime > rq->min_vruntime) {
+            rq->min_vruntime = get_job(S, idx)->vruntime;
+        }
+    } else {
+        idx = queue_pop(S, &rq->ready_q);
+    }
+    if (idx != -1) {
+        rq->nr_ready--;
+        S->nr_ready--;
+    }
+    return idx;
+}
+
+// vruntimes only compare within one queue, carry the lag over
+static void migrate(SharedState *S, RunQueue *from, RunQueue *to, int idx) {
+    Job *j = get_job(S, idx);
+    j->vruntime += to->min_vruntime - from->min_vruntime;
+}
+
+// Queue for a new job: the shorter of two random queues, which keeps the
+// queues close to even without looking at all of them
+int rq_place(SharedState *S, RunQueue *rqs, int n) {
+    if (n == 1) return 0;
+    unsigned int r = S->place_rng;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    S->place_rng = r;
+    int a = r % n;
+    int b = (a + 1 + (r >> 16) % (n - 1)) % n;
+    return rqs[b].nr_ready < rqs[a].nr_ready ? b : a;
+}
+
+// Slot `to` is idle and its own queue is empty: take the next job of the
+// busiest queue. Returns the job, already off its queue, or -1.
+int rq_steal(SharedState *S, RunQueue *rqs, int n, int to) {
+    int busiest = -1;
+    for (int i = 0; i < n; i++) {
+        if (i != to && rqs[i].nr_ready > 0 && (busiest == -1 || rqs[i].nr_ready > rqs[busiest].nr_ready))
+            busiest = i;
+    }
+    if (busiest == -1) return -1;
+
+    int idx = dequeue(S, &rqs[busiest]);
+    if (idx != -1) migrate(S, &rqs[busiest], &rqs[to], idx);
+    return idx;
+}
+
+// Move jobs from queues longer than the average to shorter ones, so no
+// job waits behind a long queue while another slot has little to do.
+// Returns the number of jobs moved.
+int rq_balance(SharedState *S, RunQueue *rqs, int n) {
+    int avg = (S->nr_ready + n - 1) / n;
+    int moved = 0;
+    int dst = 0;
+
+    for (int src = 0; src < n; src++) {
+        while (rqs[src].nr_ready > avg) {
+            while (dst < n && rqs[dst].nr_ready >= avg) dst++;
+            if (dst == n) return moved;
+            int idx = dequeue(S, &rqs[src]);
+            migrate(S, &rqs[src], &rqs[dst], idx);
+            enqueue(S, &rqs[dst], idx);
+            moved++;
+        }
+    }
+    return moved;
+}
+
+// called with the CPU time the job used before it is enqueued again
+void policy_preempted(SharedState *S, int idx, long long ran_ns) {
+    Job *j = get_job(S, idx);
+
+    if (S->policy == POLICY_MLFQ && j->level < MLFQ_LEVELS - 1) {
+        j->level++;
+    } else if (S->policy == POLICY_CFS) {
+        j->vruntime += ran_ns * NICE_0_WEIGHT / prio_to_weight[j->priority - PRIO_MIN];
+    }
+
+    // CPU-bound jobs (busy for most of their quantum) get longer quanta,
+    // jobs that mostly sleep get shorter ones
+    if (S->adaptive) {
+        long long granted_ns = (long long)j->slice_granted * S->tslice_ms * 1000000LL;
+        if (ran_ns * 10 >= granted_ns * 9) {
+            if (j->adapt_quantum < ADAPT_MAX_QUANTUM) j->adapt_quantum *= 2;
+        } else if (ran_ns * 2 < granted_ns && j->adapt_quantum > 1) {
+            j->adapt_quantum /= 2;
+        }
+    }
+}
+
+// Per-job quantum from submit wins, MLFQ gives level l 2^l ticks, and in
+// adaptive mode the job's own quantum is capped as its run queue grows
+// (full length with an empty queue, half once a job waits, and so on)
+int policy_quantum(SharedState *S, RunQueue *rq, int idx) {
+    Job *j = get_job(S, idx);
+
+    if (j->quantum > 0) return j->quantum;
+
+    if (S->adaptive) {
+        int cap = ADAPT_MAX_QUANTUM / (1 + rq->nr_ready);
+        if (cap < 1) cap = 1;
+        return j->adapt_quantum < cap ? j->adapt_quantum : cap;
+    }
+    if (S->policy == POLICY_MLFQ) return 1 << j->level;
+    return 1;
+}
+
+// periodic boost so demoted CPU-bound jobs cannot starve; slice may jump
+// by more than one when timer ticks were missed. running[] holds the job
+// on each of the n slots, -1 when free.
+void policy_slice_end(SharedState *S, RunQueue *rqs, const int *running, int n, int slice) {
+    if (S->policy != POLICY_MLFQ || slice - S->last_boost < MLFQ_BOOST_SLICES) return;
+    S->last_boost = slice;
+
+    for (int s = 0; s < n; s++) {
+        if (running[s] == -1) continue;
+        Job *j = get_job(S, running[s]);
+        j->level = base_level(j);
+    }
+
+    for (int q = 0; q < n; q++) {
+        JobQueue boosted[MLFQ_LEVELS];
+        for (int l = 0; l < MLFQ_LEVELS; l++) {
+            queue_init(&boosted[l]);
+        }
+        for (int l = 0; l < MLFQ_LEVELS; l++) {
+            int idx;
+            while ((idx = queue_pop(S, &rqs[q].level_q[l])) != -1) {
+                Job *j = get_job(S, idx);
+                j->level = base_level(j);
+                queue_push(S, &boosted[j->level], idx);
+            }
+        }
+        memcpy(rqs[q].level_q, boosted, sizeof(boosted));
+    }
+}
+
+// starting state for a job about to be queued on rq for the first time
+void policy_job_init(SharedState *S, RunQueue *rq, Job *j) {
+    (void)S;
+    j->level = base_level(j);
+    j->adapt_quantum = 1;
+    // new jobs start level with the least served job instead of jumping ahead of everyone
+    j->vruntime = rq->min_vruntime;
+}
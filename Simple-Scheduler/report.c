@@ -0,0 +1,263 @@
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+/*
+ * Execution report: per-job table plus percentiles, and the same data
+ * exported as CSV or JSON. Times are kept in ns and shown in ms.
+ */
+
+#define NS_PER_MS 1000000.0
+
+// per-job times in ms, jobs that are not done yet count up to now
+typedef struct {
+    double turnaround, wait, response, user, sys, quantum;
+} JobTimes;
+
+static JobTimes job_times(Job *j, int TSLICE, long long now) {
+    JobTimes t;
+    long long end = j->state == DONE ? j->completion_ns : now;
+
+    t.turnaround = (end - j->submit_ns) / NS_PER_MS;
+    t.wait = j->wait_ns / NS_PER_MS;
+    t.response = j->first_run_ns ? (j->first_run_ns - j->submit_ns) / NS_PER_MS : -1;
+    t.user = j->user_ns / NS_PER_MS;
+    t.sys = j->sys_ns / NS_PER_MS;
+    // effective quantum: ticks granted per context switch, in-place renewals included
+    t.quantum = j->switches ? (double)j->quantum_sum * TSLICE / j->switches : 0;
+    return t;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentiles over n values, sorts v in place
+static Summary summarize(double *v, int n) {
+    Summary s = { 0, 0, 0, 0 };
+    if (n == 0) return s;
+
+    qsort(v, n, sizeof(double), cmp_double);
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += v[i];
+    s.mean = sum / n;
+    s.p50 = v[(n * 50 + 99) / 100 - 1];
+    s.p95 = v[(n * 95 + 99) / 100 - 1];
+    s.p99 = v[(n * 99 + 99) / 100 - 1];
+    return s;
+}
+
+// summaries over the finished jobs still in the table, cancelled ones never
+// ran, checkpointed ones will go on in the next session and killed ones were
+// stopped at shutdown before they could finish
+int report_summary(SharedState *S, int TSLICE, Summary *turnaround, Summary *wait, Summary *response) {
+    int n = 0, nr = 0;
+    double *t = malloc((S->job_count + 1) * sizeof(double));
+    double *w = malloc((S->job_count + 1) * sizeof(double));
+    double *r = malloc((S->job_count + 1) * sizeof(double));
+    if (!t || !w || !r) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (int i = 0; i < S->job_count; i++) {
+        Job *j = get_job(S, i);
+        if (j->state != DONE || j->exit_status == EXIT_CANCELLED || j->exit_status == EXIT_CHECKPOINTED ||
+            j->exit_status == EXIT_KILLED)
+            continue;
+        JobTimes jt = job_times(j, TSLICE, 0);
+        t[n] = jt.turnaround;
+        w[n] = jt.wait;
+        n++;
+        if (jt.response >= 0) r[nr++] = jt.response;
+    }
+    *turnaround = summarize(t, n);
+    *wait = summarize(w, n);
+    *response = summarize(r, nr);
+
+    free(t);
+    free(w);
+    free(r);
+    return n;
+}
+
+static const char *state_name(Job *j) {
+    if (j->state == DONE && j->exit_status == EXIT_CANCELLED) return "cancelled";
+    if (j->state == DONE && j->exit_status == EXIT_CHECKPOINTED) return "checkpointed";
+    if (j->state == DONE && j->exit_status == EXIT_KILLED) return "killed";
+    switch (j->state) {
+    case READY:   return "ready";
+    case RUNNING: return "running";
+    case BLOCKED: return "blocked";
+    default:      return "done";
+    }
+}
+
+void print_report(SharedState *S, int TSLICE) {
+    long long now = monotonic_ns();
+
+    printf("\nExecution Report:\n");
+    printf("Policy: %s%s, job control: %s\n", policy_name(S->policy), S->adaptive ? " (adaptive quanta)" : "",
+           S->backend == BACKEND_CGROUP ? "cgroup" : "signals");
+    printf("%-6s\t%-20s\t%-8s\t%-4s\t%12s\t%10s\t%12s\t%9s\t%9s\t%11s\t%8s\t%10s\n", "Id", "Name", "PID", "Prio",
+           "Turnaround", "Wait", "Response", "User", "Sys", "Quantum", "Switches", "Migrations");
+
+    for (int i = 0; i < S->job_count; i++) {
+        Job *j = get_job(S, i);
+        JobTimes t = job_times(j, TSLICE, now);
+
+        printf("%-6d\t%-20s\t%-8d\t%-4d\t%9.3f ms\t%7.3f ms\t", j->id, j->name, j->pid, j->priority, t.turnaround, t.wait);
+        if (t.response >= 0) {
+            printf("%9.3f ms\t", t.response);
+        } else {
+            printf("%12s\t", j->exit_status == EXIT_CANCELLED ? "cancelled" :
+                              j->exit_status == EXIT_KILLED ? "killed" : "-");
+        }
+        printf("%6.1f ms\t%6.1f ms\t%8.1f ms\t%8d\t%10d\n", t.user, t.sys, t.quantum, j->switches, j->migrations);
+    }
+
+    Summary turnaround, wait, response;
+    int n = report_summary(S, TSLICE, &turnaround, &wait, &response);
+    if (n > 0) {
+        printf("\n%d finished jobs (ms)\t%10s\t%10s\t%10s\t%10s\n", n, "mean", "p50", "p95", "p99");
+        printf("%-20s\t%10.3f\t%10.3f\t%10.3f\t%10.3f\n", "Turnaround", turnaround.mean, turnaround.p50, turnaround.p95, turnaround.p99);
+        printf("%-20s\t%10.3f\t%10.3f\t%10.3f\t%10.3f\n", "Wait", wait.mean, wait.p50, wait.p95, wait.p99);
+        printf("%-20s\t%10.3f\t%10.3f\t%10.3f\t%10.3f\n", "Response", response.mean, response.p50, response.p95, response.p99);
+    }
+    if (S->retired_jobs > 0) {
+        printf("%d earlier jobs (slots recycled): avg turnaround %.3f ms, avg wait %.3f ms, avg response %.3f ms\n",
+               S->retired_jobs, S->retired_turnaround / NS_PER_MS / S->retired_jobs,
+               S->retired_wait / NS_PER_MS / S->retired_jobs,
+               S->retired_response / NS_PER_MS / S->retired_jobs);
+    }
+    fflush(stdout);
+}
+
+int print_job_status(SharedState *S, int TSLICE, int id) {
+    int idx = find_job(S, id);
+    if (idx == -1) return -1;
+
+    Job *j = get_job(S, idx);
+    JobTimes t = job_times(j, TSLICE, monotonic_ns());
+    char buf[RESULT_MAX];
+    int len = read_result(S, idx, id, buf);
+
+    printf("Job %d: %s\n", j->id, j->name);
+    printf("  state %s, pid %d, threads %d (%s)", state_name(j), j->pid, j->threads,
+           j->threads_req ? "declared" : "detected");
+    int st = j->exit_status;
+    if (st >= 0 && WIFEXITED(st)) {
+        printf(", exit status %d", WEXITSTATUS(st));
+    } else if (st >= 0 && WIFSIGNALED(st)) {
+        printf(", killed by signal %d", WTERMSIG(st));
+    }
+    printf("\n  turnaround %.3f ms, wait %.3f ms, user %.1f ms, sys %.1f ms\n",
+           t.turnaround, t.wait, t.user, t.sys);
+    if (len >= 0) {
+        printf("  result %d bytes\n", len);
+    } else {
+        printf("  result unreadable\n");
+    }
+    return 0;
+}
+
+// job names are command lines; quote them for CSV (doubling '"') or
+// escape them for JSON, including control characters
+static void put_escaped(FILE *f, const char *s, int json) {
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (!json) {
+            if (c == '"') fputc('"', f);
+            fputc(c, f);
+        } else if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c == '\n') {
+            fputs("\\n", f);
+        } else if (c == '\t') {
+            fputs("\\t", f);
+        } else if (c == '\r') {
+            fputs("\\r", f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+}
+
+static void export_csv(SharedState *S, int TSLICE, FILE *f) {
+    long long now = monotonic_ns();
+
+    fprintf(f, "id,name,pid,priority,state,exit_status,submit_ns,first_run_ns,completion_ns,"
+               "turnaround_ms,wait_ms,response_ms,user_ms,sys_ms,quantum_ms,switches,migrations,threads\n");
+    for (int i = 0; i < S->job_count; i++) {
+        Job *j = get_job(S, i);
+        JobTimes t = job_times(j, TSLICE, now);
+        fprintf(f, "%d,\"", j->id);
+        put_escaped(f, j->name, 0);
+        fprintf(f, "\",%d,%d,%s,%d,%lld,%lld,%lld,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%d,%d,%d\n",
+                j->pid, j->priority, state_name(j), j->exit_status,
+                j->submit_ns, j->first_run_ns, j->completion_ns,
+                t.turnaround, t.wait, t.response, t.user, t.sys, t.quantum, j->switches, j->migrations, j->threads);
+    }
+}
+
+static void json_summary(FILE *f, const char *name, Summary *s, int last) {
+    fprintf(f, "    \"%s\": {\"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f}%s\n",
+            name, s->mean, s->p50, s->p95, s->p99, last ? "" : ",");
+}
+
+static void export_json(SharedState *S, int TSLICE, FILE *f) {
+    long long now = monotonic_ns();
+
+    fprintf(f, "{\n  \"policy\": \"%s\",\n  \"adaptive\": %s,\n  \"backend\": \"%s\",\n  \"jobs\": [\n",
+            policy_name(S->policy), S->adaptive ? "true" : "false",
+            S->backend == BACKEND_CGROUP ? "cgroup" : "signals");
+    for (int i = 0; i < S->job_count; i++) {
+        Job *j = get_job(S, i);
+        JobTimes t = job_times(j, TSLICE, now);
+        fprintf(f, "    {\"id\": %d, \"name\": \"", j->id);
+        put_escaped(f, j->name, 1);
+        fprintf(f, "\", \"pid\": %d, \"priority\": %d, \"state\": \"%s\", \"exit_status\": %d, "
+                   "\"turnaround_ms\": %.3f, \"wait_ms\": %.3f, \"response_ms\": %.3f, "
+                   "\"user_ms\": %.3f, \"sys_ms\": %.3f, \"quantum_ms\": %.1f, "
+                   "\"switches\": %d, \"migrations\": %d, \"threads\": %d}%s\n",
+                j->pid, j->priority, state_name(j), j->exit_status,
+                t.turnaround, t.wait, t.response, t.user, t.sys, t.quantum,
+                j->switches, j->migrations, j->threads, i + 1 < S->job_count ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+
+    Summary turnaround, wait, response;
+    int n = report_summary(S, TSLICE, &turnaround, &wait, &response);
+    fprintf(f, "  \"summary\": {\n    \"finished\": %d,\n    \"retired\": %d,\n", n, S->retired_jobs);
+    json_summary(f, "turnaround_ms", &turnaround, 0);
+    json_summary(f, "wait_ms", &wait, 0);
+    json_summary(f, "response_ms", &response, 1);
+    fprintf(f, "  }\n}\n");
+}
+
+int export_report(SharedState *S, int TSLICE, const char *path) {
+    const char *ext = strrchr(path, '.');
+    int json = ext && strcmp(ext, ".json") == 0;
+    if (!json && !(ext && strcmp(ext, ".csv") == 0)) {
+        fprintf(stderr, "Error: report file must end in .csv or .json\n");
+        return -1;
+    }
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("fopen");
+        return -1;
+    }
+    if (json) {
+        export_json(S, TSLICE, f);
+    } else {
+        export_csv(S, TSLICE, f);
+    }
+    fclose(f);
+    return 0;
+}
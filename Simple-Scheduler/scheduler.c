@@ -1,4 +1,6 @@
+#define _GNU_SOURCE
 #include "scheduler.h"
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,187 +9,1105 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <time.h>
 
 static SharedState *shared_state = NULL;
 static int num_cpu;
 static int time_slice_ms;            // milliseconds
-static int running_job_indices[MAX_JOBS];
+static int *slot_job;                // job running in each of the NCPU slots, -1 = free
+static int *slot_cpu;                // CPU each slot is pinned to
+static RunQueue *rq;                 // run queue of each slot
+static int *free_slots;              // stack of the free slots
+static int nr_free = 0;
+static int gang_wait = -1;           // job waiting for enough free slots, nothing else is dispatched meanwhile
 static int num_running_jobs = 0;
 static int current_time_slice = 0;
 static volatile int exit_requested = 0;
 
+// event loop descriptors, see run_scheduler()
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static int signal_fd = -1;
+static int timer_armed = 0;
+static sigset_t orig_mask;           // restored in job children before exec
+
 static void cleanup_child_processes(void);
+static void job_finished(SharedState *S, int idx);
+
+// Local mapping of the job table, each process keeps its own
+static Job *mapped_jobs = NULL;
+static int mapped_capacity = 0;
+static JobResult *mapped_results = NULL;
+static int mapped_result_capacity = 0;
+
+int job_table_init(SharedState *S) {
+    S->job_fd = memfd_create("sched_jobs", MFD_CLOEXEC);
+    if (S->job_fd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+    if (ftruncate(S->job_fd, JOB_TABLE_INIT * sizeof(Job)) < 0) {
+        perror("ftruncate");
+        close(S->job_fd);
+        return -1;
+    }
+    S->result_fd = memfd_create("sched_results", MFD_CLOEXEC);
+    if (S->result_fd < 0 || ftruncate(S->result_fd, JOB_TABLE_INIT * sizeof(JobResult)) < 0) {
+        perror("result slots");
+        if (S->result_fd >= 0) close(S->result_fd);
+        close(S->job_fd);
+        return -1;
+    }
+    S->job_capacity = JOB_TABLE_INIT;
+    S->job_count = 0;
+    queue_init(&S->done_q);
+    return 0;
+}
+
+void job_table_destroy(SharedState *S) {
+    if (mapped_jobs) {
+        munmap(mapped_jobs, mapped_capacity * sizeof(Job));
+        mapped_jobs = NULL;
+        mapped_capacity = 0;
+    }
+    if (mapped_results) {
+        munmap(mapped_results, mapped_result_capacity * sizeof(JobResult));
+        mapped_results = NULL;
+        mapped_result_capacity = 0;
+    }
+    if (S->job_fd >= 0) {
+        close(S->job_fd);
+        S->job_fd = -1;
+    }
+    if (S->result_fd >= 0) {
+        close(S->result_fd);
+        S->result_fd = -1;
+    }
+}
+
+// Remap if the table grew since this process last looked at it
+Job *get_job(SharedState *S, int idx) {
+    if (mapped_capacity != S->job_capacity) {
+        size_t new_size = S->job_capacity * sizeof(Job);
+        void *m;
+        if (mapped_jobs) {
+            m = mremap(mapped_jobs, mapped_capacity * sizeof(Job), new_size, MREMAP_MAYMOVE);
+        } else {
+            m = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, S->job_fd, 0);
+        }
+        if (m == MAP_FAILED) {
+            perror("mapping job table");
+            exit(1);
+        }
+        mapped_jobs = m;
+        mapped_capacity = S->job_capacity;
+    }
+    return &mapped_jobs[idx];
+}
+
+// linear scan, for shell commands only
+int find_job(SharedState *S, int id) {
+    for (int i = 0; i < S->job_count; i++) {
+        if (get_job(S, i)->id == id) return i;
+    }
+    return -1;
+}
+
+// Result slots follow the job table capacity, remapped the same way
+JobResult *get_result(SharedState *S, int idx) {
+    if (mapped_result_capacity != S->job_capacity) {
+        size_t new_size = S->job_capacity * sizeof(JobResult);
+        void *m;
+        if (mapped_results) {
+            m = mremap(mapped_results, mapped_result_capacity * sizeof(JobResult), new_size, MREMAP_MAYMOVE);
+        } else {
+            m = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, S->result_fd, 0);
+        }
+        if (m == MAP_FAILED) {
+            perror("mapping result slots");
+            exit(1);
+        }
+        mapped_results = m;
+        mapped_result_capacity = S->job_capacity;
+    }
+    return &mapped_results[idx];
+}
 
-static void sigterm_handler(int signum) {
-    if(signum==SIGTERM) {
-        exit_requested=1;
+// Copy the result of job id out of r while it may still be written:
+// retry until the sequence number is even and unchanged, at most tries
+// times. *seqp gets the sequence number of the copy.
+static int copy_result(JobResult *r, int id, char *buf, int tries, unsigned *seqp) {
+    for (int t = 0; t < tries; t++) {
+        unsigned seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+        if (r->id != id) return -1;
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        unsigned len = r->len;
+        if (len > (unsigned)RESULT_MAX) len = RESULT_MAX;
+        memcpy(buf, r->data, len);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&r->seq, memory_order_relaxed) == seq) {
+            if (seqp) *seqp = seq;
+            return len;
+        }
+    }
+    return -1;   // the job died while writing, or keeps rewriting it
+}
+
+int read_result(SharedState *S, int idx, int id, char *buf) {
+    return copy_result(get_result(S, idx), id, buf, 1000, NULL);
+}
+
+// A job only gets its own one-page memfd, never the shared slots of the
+// other jobs. The scheduler copies that page into the job's shared slot,
+// where the shell reads it, each slice the job runs and when it ends.
+static int new_job_result(Job *j) {
+    int fd = memfd_create("sched_job_result", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, sizeof(JobResult)) < 0) {
+        perror("job result");
+        if (fd >= 0) close(fd);
+        j->own_result = NULL;
+        return -1;
     }
+    JobResult *r = mmap(NULL, sizeof(JobResult), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (r == MAP_FAILED) {
+        perror("job result");
+        close(fd);
+        j->own_result = NULL;
+        return -1;
+    }
+    r->id = j->id;   // the rest of a new memfd is zero: seq 0, CKPT_NONE
+    j->own_result = r;
+    j->result_seq = 0;
+    return fd;
+}
+
+static void sync_result(int idx) {
+    Job *j = get_job(shared_state, idx);
+    JobResult *own = j->own_result;
+    if (!own || atomic_load_explicit(&own->seq, memory_order_acquire) == j->result_seq) return;
+
+    // the job is stopped or gone when this matters, one try is enough;
+    // a write in progress is picked up the next time
+    char buf[RESULT_MAX];
+    unsigned seq;
+    int len = copy_result(own, j->id, buf, 1, &seq);
+    if (len < 0) return;
+
+    JobResult *r = get_result(shared_state, idx);
+    unsigned s = atomic_load_explicit(&r->seq, memory_order_relaxed);
+    atomic_store_explicit(&r->seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(r->data, buf, len);
+    r->len = len;
+    atomic_store_explicit(&r->seq, s + 2, memory_order_release);
+    j->result_seq = seq;
+}
+
+static void release_result(int idx) {
+    Job *j = get_job(shared_state, idx);
+    if (!j->own_result) return;
+    sync_result(idx);
+    munmap(j->own_result, sizeof(JobResult));
+    j->own_result = NULL;
 }
 
-void enqueue(SharedState *S, int idx) {
-    S->ready_q[S->rq_tail] = idx;
-    S->rq_tail = (S->rq_tail + 1) % MAX_JOBS;
-    S->rq_size++;
+void queue_init(JobQueue *q) {
+    q->head = q->tail = -1;
+    q->size = 0;
 }
 
-int dequeue(SharedState *S) {
-    if (S->rq_size == 0) return -1;
-    int idx = S->ready_q[S->rq_head];
-    S->rq_head = (S->rq_head + 1) % MAX_JOBS;
-    S->rq_size--;
+void queue_push(SharedState *S, JobQueue *q, int idx) {
+    get_job(S, idx)->next = -1;
+    if (q->size == 0) {
+        q->head = idx;
+    } else {
+        get_job(S, q->tail)->next = idx;
+    }
+    q->tail = idx;
+    q->size++;
+}
+
+int queue_pop(SharedState *S, JobQueue *q) {
+    if (q->size == 0) return -1;
+    int idx = q->head;
+    q->head = get_job(S, idx)->next;
+    q->size--;
+    if (q->size == 0) q->head = q->tail = -1;
     return idx;
 }
 
+int submit_queue_init(SharedState *S) {
+    SubmitQueue *q = &S->new_job_q;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+
+    atomic_init(&S->next_job_id, 1);
+
+    S->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (S->doorbell_fd < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+int submit_push(SharedState *S, const JobRequest *req) {
+    return submit_push_batch(S, req, 1) == 1 ? 0 : -1;
+}
+
+// Queue up to n requests with a single store of head and a single
+// doorbell write. Returns how many were queued, 0 when the ring is full.
+int submit_push_batch(SharedState *S, const JobRequest *reqs, int n) {
+    SubmitQueue *q = &S->new_job_q;
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    int room = MAX_PENDING - (int)(head - tail);
+    int k = n < room ? n : room;
+    if (k <= 0) return 0;
+
+    for (int i = 0; i < k; i++) {
+        JobRequest *slot = &q->slots[(head + i) % MAX_PENDING];
+        *slot = reqs[i];
+        slot->path[sizeof(slot->path) - 1] = '\0';
+    }
+    // publish the requests to the scheduler
+    atomic_store_explicit(&q->head, head + k, memory_order_release);
+    uint64_t one = 1;
+    write(S->doorbell_fd, &one, sizeof(one));
+    return k;
+}
+
+int submit_pop(SharedState *S, JobRequest *req) {
+    SubmitQueue *q = &S->new_job_q;
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail == head) return -1;
+
+    *req = q->slots[tail % MAX_PENDING];
+    // hand the slot back to the shell
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+int submit_pending(SharedState *S) {
+    SubmitQueue *q = &S->new_job_q;
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+    return (int)(head - tail);
+}
+
+int submit_id(SharedState *S, int n) {
+    return atomic_fetch_add(&S->next_job_id, n);
+}
+
+long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long timeval_ns(struct timeval *tv) {
+    return tv->tv_sec * 1000000000LL + tv->tv_usec * 1000LL;
+}
+
+// record how a reaped job ended
+static void job_exited(int idx, int status, struct rusage *ru) {
+    Job *j = get_job(shared_state, idx);
+    release_result(idx);
+    cgroup_detach(j);
+    atomic_fetch_add(&shared_state->jobs_ended, 1);
+    j->completion_ns = monotonic_ns();
+    j->exit_status = status;
+    if (ru) {
+        j->user_ns = timeval_ns(&ru->ru_utime);
+        j->sys_ns = timeval_ns(&ru->ru_stime);
+    }
+}
+
+// pause/resume a job with the backend it was set up with
+static void job_stop(Job *j) {
+    if (j->cg_fd < 0 || cgroup_freeze(j, 1) < 0) kill(j->pid, SIGSTOP);
+}
+
+static void job_cont(Job *j) {
+    if (j->cg_fd < 0 || cgroup_freeze(j, 0) < 0) kill(j->pid, SIGCONT);
+}
+
+// first time a job becomes ready: spread new jobs over the run queues
+static void enqueue_new(int idx) {
+    RunQueue *q = &rq[rq_place(shared_state, rq, num_cpu)];
+    policy_job_init(shared_state, q, get_job(shared_state, idx));
+    enqueue(shared_state, q, idx);
+}
+
+// all predecessors of a blocked job finished successfully
+static void release_job(int idx) {
+    Job *j = get_job(shared_state, idx);
+    j->state = READY;
+    j->ready_since_ns = monotonic_ns();
+    enqueue_new(idx);
+}
+
+// a job that has not run yet is dropped because a predecessor failed
+static void cancel_job(int idx) {
+    Job *j = get_job(shared_state, idx);
+    int status;
+    struct rusage ru;
+
+    if (j->cg_fd >= 0) {
+        cgroup_kill(j);
+    } else {
+        kill(j->pid, SIGKILL);
+    }
+    wait4(j->pid, &status, 0, &ru);
+    job_exited(idx, status, &ru);
+    j->exit_status = EXIT_CANCELLED;
+    job_finished(shared_state, idx);
+}
+
+// wake up or cancel the jobs waiting for this one
+static void resolve_dependents(int idx) {
+    int st = get_job(shared_state, idx)->exit_status;
+    int ok = st >= 0 && WIFEXITED(st) && WEXITSTATUS(st) == 0;
+    deps_done(shared_state, idx, ok, release_job, cancel_job);
+}
+
+// a restored job ended, its checkpoint is not needed any more
+static void drop_restore(Job *j) {
+    if (!j->restore[0]) return;
+    char path[300];
+    checkpoint_path(shared_state, j->restore, path, sizeof(path));
+    unlink(path);
+    j->restore[0] = '\0';
+}
+
+static void job_finished(SharedState *S, int idx) {
+    Job *j = get_job(S, idx);
+    drop_restore(j);
+    j->state = DONE;
+    queue_push(S, &S->done_q, idx);
+    resolve_dependents(idx);
+}
+
+// O(1) slot allocation: a fresh slot while the table has room, otherwise
+// the oldest finished job is retired into the report totals and its slot
+// reused; the table only doubles when every slot holds a live job.
+static int job_alloc(SharedState *S) {
+    if (S->job_count < S->job_capacity) {
+        return S->job_count++;
+    }
+
+    int idx = queue_pop(S, &S->done_q);
+    if (idx != -1) {
+        Job *old = get_job(S, idx);
+        S->retired_jobs++;
+        S->retired_turnaround += old->completion_ns - old->submit_ns;
+        S->retired_wait += old->wait_ns;
+        if (old->first_run_ns) S->retired_response += old->first_run_ns - old->submit_ns;
+        return idx;
+    }
+
+    int new_capacity = S->job_capacity * 2;
+    if (ftruncate(S->job_fd, new_capacity * sizeof(Job)) < 0 ||
+        ftruncate(S->result_fd, new_capacity * sizeof(JobResult)) < 0) {
+        perror("growing job table");
+        return -1;
+    }
+    S->job_capacity = new_capacity;
+    return S->job_count++;
+}
+
 static void check_for_new_jobs(void) {
-    while (shared_state->njq_size > 0 && shared_state->job_count < MAX_JOBS) {
-        char *path = shared_state->new_job_q[shared_state->njq_head];
-        shared_state->njq_head = (shared_state->njq_head + 1) % MAX_JOBS;
-        shared_state->njq_size--;
+    JobRequest req;
+    char *path = req.path;
 
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("fork failed");
+    while (submit_pop(shared_state, &req) == 0) {
+
+        int idx = req.path[0] ? job_alloc(shared_state) : -1;
+        if (idx == -1) {
+            deps_drop(shared_state, req.id, cancel_job);
+            atomic_fetch_add(&shared_state->jobs_ended, 1);
             continue;
         }
+        JobResult *r = get_result(shared_state, idx);
+        r->id = req.id;
+        atomic_store(&r->seq, 0);
+        r->len = 0;
+        atomic_store(&r->checkpoint, CKPT_NONE);
+
+        // the job's own result page, created before the fork so the child inherits it
+        Job *j = get_job(shared_state, idx);
+        j->id = req.id;
+        int result_fd = new_job_result(j);
+
+        pid_t pid = fork();
 
         if (pid == 0) { 
             signal(SIGINT, SIG_DFL);
             signal(SIGTERM, SIG_DFL);
+            signal(SIGCHLD, SIG_DFL);
+            sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+
+            // read by dummy_main.h; the job table and the shared result
+            // slots are close-on-exec, only the job's own page is passed on
+            if (result_fd >= 0) {
+                char env[32];
+                fcntl(result_fd, F_SETFD, 0);
+                snprintf(env, sizeof(env), "%d", result_fd);
+                setenv("SCHED_RESULT_FD", env, 1);
+                setenv("SCHED_RESULT_OFFSET", "0", 1);
+            }
+            char key[CKPT_KEY_LEN], file[300];
+            checkpoint_key(shared_state, req.id, key);
+            checkpoint_path(shared_state, key, file, sizeof(file));
+            setenv("SCHED_CHECKPOINT_FILE", file, 1);
+            if (req.restore[0]) {
+                checkpoint_path(shared_state, req.restore, file, sizeof(file));
+                setenv("SCHED_RESTORE_FILE", file, 1);
+            }
 
-            char *argv[2];
-            argv[0] = path;
-            argv[1] = NULL;
+            char *argv[MAX_JOB_ARGS + 2];
+            int argc = 0;
+            char *a = req.args;
+            argv[argc++] = path;
+            for (int k = 0; k < req.nargs && k < MAX_JOB_ARGS; k++) {
+                argv[argc++] = a;
+                a += strlen(a) + 1;
+            }
+            argv[argc] = NULL;
+
+            // stop before exec, so the scheduler knows for sure when the
+            // job is stopped; dummy_main.h then skips its own raise(SIGSTOP)
+            setenv("SCHED_STOPPED", "1", 1);
+            raise(SIGSTOP);
 
             execvp(argv[0], argv);
             perror("execvp failed");
             _exit(127);
         }
 
-        // Stop child until scheduled
-        kill(pid, SIGSTOP);
+        if (result_fd >= 0) close(result_fd);
 
         // Initialize job struct
-        int idx = shared_state->job_count++;
-        Job *j = &shared_state->jobs[idx];
         j->pid = pid;
-        strncpy(j->name, path, sizeof(j->name) - 1);
-        j->name[sizeof(j->name) - 1] = '\0';
+        // the name shown in the report is the command line
+        int len = snprintf(j->name, sizeof(j->name), "%s", path);
+        const char *a = req.args;
+        for (int k = 0; k < req.nargs && len < (int)sizeof(j->name); k++) {
+            len += snprintf(j->name + len, sizeof(j->name) - len, " %s", a);
+            a += strlen(a) + 1;
+        }
+        memcpy(j->path, req.path, sizeof(j->path));
+        memcpy(j->args, req.args, sizeof(j->args));
+        j->nargs = req.nargs;
         j->state = READY;
         j->started = 0;
-        j->completion_slice = 0;
         j->slices_ran = 0;
-        j->slices_waited = 0;
-        j->submission_slice = current_time_slice;
+        j->submit_ns = req.submit_ns ? req.submit_ns : monotonic_ns();
+        j->first_run_ns = 0;
+        j->completion_ns = 0;
+        j->ready_since_ns = monotonic_ns();
+        j->wait_ns = 0;
+        j->user_ns = j->sys_ns = 0;
+        j->exit_status = -1;
+        j->priority = req.priority;
+        j->cpu_ns = 0;
+        j->quantum = req.quantum;
+        j->switches = 0;
+        j->quantum_sum = 0;
+        j->last_slot = -1;
+        j->cpu = -1;
+        j->migrations = 0;
+        j->cg_fd = -1;
+        j->cg_cpus = 1;
+        j->threads_req = req.threads;
+        j->threads = req.threads ? req.threads : 1;
+        j->nr_slots = 0;
+        memcpy(j->restore, req.restore, sizeof(j->restore));
+        j->nafter = req.nafter;
+        memcpy(j->after, req.after, sizeof(j->after));
+
+        if (pid < 0) {
+            // recorded like a failed exec, so dependents are cancelled
+            perror("fork failed");
+            j->pid = 0;
+            job_exited(idx, 127 << 8, NULL);
+            job_finished(shared_state, idx);
+            continue;
+        }
+
+        // Wait until the child has stopped itself, so a later SIGCONT can
+        // never be overtaken by that stop and the job runs as soon as it
+        // is dispatched. A frozen cgroup holds it from then on.
+        int st;
+        struct rusage ru;
+        if (wait4(pid, &st, WUNTRACED, &ru) != pid || !WIFSTOPPED(st)) {
+            job_exited(idx, st, &ru);
+            job_finished(shared_state, idx);
+            continue;
+        }
+        if (shared_state->backend == BACKEND_CGROUP && cgroup_attach(j) == 0) {
+            kill(pid, SIGCONT);
+        }
 
-        enqueue(shared_state, idx);
+        // jobs with unfinished predecessors wait outside the ready queue
+        int deps = deps_add(shared_state, idx, req.after, req.nafter);
+        if (deps < 0) {
+            cancel_job(idx);
+        } else if (deps > 0) {
+            j->state = BLOCKED;
+        } else {
+            enqueue_new(idx);
+        }
     }
 }
 
 
-static void handle_time_slice(void) {
-    current_time_slice++;
+// Slot i is pinned to the i-th CPU the scheduler itself may run on,
+// wrapping around when NCPU is larger than that set
+static void assign_slot_cpus(void) {
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int n = 0;
 
-    int currently_running_count = num_running_jobs;
-    num_running_jobs = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed)) cpus[n++] = c;
+        }
+    }
+    for (int i = 0; i < num_cpu; i++) {
+        slot_cpu[i] = n ? cpus[i % n] : -1;
+        slot_job[i] = -1;
+        runqueue_init(&rq[i]);
+        free_slots[nr_free++] = num_cpu - 1 - i;
+    }
+}
 
-    for (int i = 0; i < currently_running_count; i++) {
-        int job_idx = running_job_indices[i];
-        Job *j = &shared_state->jobs[job_idx];
+// slots a job takes when it is dispatched
+static int job_width(Job *j) {
+    if (j->threads < 1) return 1;
+    return j->threads < num_cpu ? j->threads : num_cpu;
+}
 
-        j->slices_ran++;
-        kill(j->pid, SIGSTOP);
+// threads of a running job, -1 if it is gone
+static int count_threads(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *d = opendir(path);
+    if (!d) return -1;
 
-        int status;
-        pid_t r = waitpid(j->pid, &status, WNOHANG);
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] != '.') n++;
+    }
+    closedir(d);
+    return n;
+}
 
-        if (r == j->pid || (kill(j->pid, 0) == -1 && errno == ESRCH)) {
-            j->state = DONE;
-            j->completion_slice = current_time_slice;
-        } else {
-            j->state = READY;
-            enqueue(shared_state, job_idx);
+// Affinity is per thread: a multi-threaded job gets the CPUs of all its
+// slots on every thread, threads it creates later inherit them
+static int set_job_affinity(Job *j, cpu_set_t *set) {
+    if (j->threads <= 1) return sched_setaffinity(j->pid, sizeof(*set), set);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", j->pid);
+    DIR *d = opendir(path);
+    if (!d) return -1;
+
+    int ok = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') continue;
+        if (sched_setaffinity(atoi(e->d_name), sizeof(*set), set) == 0) ok = 1;
+    }
+    closedir(d);
+    return ok ? 0 : -1;
+}
+
+// CPUs of the slots job idx holds, 0 if they are not pinned
+static int job_slot_cpus(int idx, cpu_set_t *set) {
+    int n = 0;
+    CPU_ZERO(set);
+    for (int s = 0; s < num_cpu; s++) {
+        if (slot_job[s] == idx && slot_cpu[s] >= 0) {
+            CPU_SET(slot_cpu[s], set);
+            n++;
+        }
+    }
+    return n;
+}
+
+static void free_slot(int slot) {
+    slot_job[slot] = -1;
+    free_slots[nr_free++] = slot;
+}
+
+// The job stopped or exited: give back every slot it holds. The one it
+// was dispatched on, where it is queued again, goes to the bottom of the
+// stack, so the jobs queued on its other slots get them first.
+static void release_slots(int idx) {
+    Job *j = get_job(shared_state, idx);
+    free_slot(j->last_slot);
+    j->nr_slots--;
+    for (int s = 0; s < num_cpu && j->nr_slots > 0; s++) {
+        if (slot_job[s] == idx) {
+            free_slot(s);
+            j->nr_slots--;
+        }
+    }
+    j->nr_slots = 0;
+    num_running_jobs--;
+}
+
+// A running job now needs fewer slots: free all but the first `width`,
+// keeping the one it was dispatched on, and narrow it to their CPUs
+static void shrink_job(int idx, int width) {
+    Job *j = get_job(shared_state, idx);
+    for (int s = 0; s < num_cpu && j->nr_slots > width; s++) {
+        if (slot_job[s] == idx && s != j->last_slot) {
+            free_slot(s);
+            j->nr_slots--;
         }
     }
+    cpu_set_t set;
+    if (job_slot_cpus(idx, &set) > 0) set_job_affinity(j, &set);
+    cgroup_set_cpus(j, j->nr_slots);
+}
 
-    while (num_running_jobs < num_cpu && shared_state->rq_size > 0) {
-        int idx_to_run = dequeue(shared_state);
-        if (idx_to_run == -1) break;
+// Dispatch job idx on `slot` plus as many free slots as it has threads,
+// so all its threads run at once (gang scheduling); the caller checked
+// they are free. Its threads are pinned to the CPUs of those slots.
+static void run_on_slot(int idx, int slot) {
+    Job *j = get_job(shared_state, idx);
+    int width = job_width(j);
 
-        Job *j = &shared_state->jobs[idx_to_run];
-        if (j->state == DONE) continue;
+    slot_job[slot] = idx;
+    j->nr_slots = 1;
+    while (j->nr_slots < width && nr_free > 0) {
+        slot_job[free_slots[--nr_free]] = idx;
+        j->nr_slots++;
+    }
 
-        kill(j->pid, SIGCONT);
-        j->state = RUNNING;
-        j->started = 1;
-        running_job_indices[num_running_jobs++] = idx_to_run;
+    if (slot_cpu[slot] >= 0 && (j->nr_slots > 1 || j->cpu != slot_cpu[slot])) {
+        cpu_set_t set;
+        job_slot_cpus(idx, &set);
+        if (set_job_affinity(j, &set) == 0) {
+            if (j->cpu >= 0 && j->cpu != slot_cpu[slot]) j->migrations++;
+            j->cpu = slot_cpu[slot];
+        }
     }
+    cgroup_set_cpus(j, j->nr_slots);
+    j->last_slot = slot;
+    num_running_jobs++;
+
+    job_cont(j);
+    long long now = monotonic_ns();
+    j->wait_ns += now - j->ready_since_ns;
+    if (!j->started) j->first_run_ns = now;
+    j->state = RUNNING;
+    j->started = 1;
+    j->switches++;
+    j->slice_granted = j->slice_left = policy_quantum(shared_state, &rq[slot], idx);
+    j->quantum_sum += j->slice_granted;
+}
 
-    for (int i = 0; i < shared_state->rq_size; i++) {
-        int idx_in_queue = shared_state->ready_q[(shared_state->rq_head + i) % MAX_JOBS];
-        shared_state->jobs[idx_in_queue].slices_waited++;
+// Resume ready jobs on every free slot, called at slice boundaries and as
+// soon as a slot frees up or a job arrives. A slot runs the next job of
+// its own run queue, where the jobs it preempted wait with their cache
+// still warm, and steals from the busiest queue when its own is empty.
+// A multi-threaded job that does not fit yet becomes gang_wait: the
+// slots freed by jobs reaching the end of their quantum are kept for it
+// until it fits, so it is not starved by single-threaded jobs.
+static void fill_free_cpus(void) {
+    while (nr_free > 0) {
+        int idx = gang_wait;
+        int slot = free_slots[nr_free - 1];
+
+        if (idx == -1) {
+            if (shared_state->nr_ready == 0) break;
+            // a free slot with jobs in its own queue goes first, so the
+            // queues of slots a gang took along are not passed over
+            for (int f = nr_free - 1; f >= 0; f--) {
+                if (rq[free_slots[f]].nr_ready > 0) {
+                    slot = free_slots[f];
+                    free_slots[f] = free_slots[nr_free - 1];
+                    free_slots[nr_free - 1] = slot;
+                    break;
+                }
+            }
+            idx = dequeue(shared_state, &rq[slot]);
+            if (idx == -1) idx = rq_steal(shared_state, rq, num_cpu, slot);
+            if (idx == -1) break;
+        }
+
+        Job *j = get_job(shared_state, idx);
+        if (j->state == DONE) {
+            // exited while waiting in a run queue, see reap_children()
+            queue_push(shared_state, &shared_state->done_q, idx);
+            gang_wait = -1;
+            continue;
+        }
+        if (job_width(j) > nr_free) {
+            gang_wait = idx;
+            break;
+        }
+        gang_wait = -1;
+        nr_free--;
+        run_on_slot(idx, slot);
     }
+}
 
+// SIGCHLD arrived: reap every exited job and free its CPU right away
+static void reap_children(void) {
+    int status;
+    struct rusage ru;
+    pid_t pid;
+
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+        int found = 0;
+        for (int i = 0; i < num_cpu; i++) {
+            int idx = slot_job[i];
+            if (idx == -1) continue;
+            Job *j = get_job(shared_state, idx);
+            if (j->pid == pid) {
+                release_slots(idx);
+                j->slices_ran++;     // the partial slice counts as one
+                job_exited(idx, status, &ru);
+                job_finished(shared_state, idx);
+                found = 1;
+                break;
+            }
+        }
+        if (found) continue;
+
+        // a stopped job killed from outside; a ready one is still linked in
+        // the ready queue, fill_free_cpus() moves it to done_q when it comes up
+        for (int i = 0; i < shared_state->job_count; i++) {
+            Job *j = get_job(shared_state, i);
+            if (j->pid != pid) continue;
+            if (j->state == READY) {
+                j->state = DONE;
+                job_exited(i, status, &ru);
+                resolve_dependents(i);
+                break;
+            }
+            if (j->state == BLOCKED) {
+                job_exited(i, status, &ru);
+                job_finished(shared_state, i);
+                break;
+            }
+        }
+    }
+}
+
+// The slice timer only runs while there is something to schedule, so an
+// idle scheduler sleeps in epoll_wait() without waking up
+static void update_timer(void) {
+    int busy = num_running_jobs > 0 || shared_state->nr_ready > 0;
+    if (busy == timer_armed) return;
+
+    struct itimerspec its = {0};
+    if (busy) {
+        its.it_value.tv_sec = time_slice_ms / 1000;
+        its.it_value.tv_nsec = (time_slice_ms % 1000) * 1000000L;
+        its.it_interval = its.it_value;
+    }
+    if (timerfd_settime(timer_fd, 0, &its, NULL) < 0) {
+        perror("timerfd_settime");
+        exit(1);
+    }
+    timer_armed = busy;
+}
+
+// CPU time of a job in nanoseconds: its cgroup's cpu.stat covers every
+// thread, /proc/<pid>/schedstat has the main thread exactly and
+// /proc/<pid>/stat (utime + stime in clock ticks) is the fallback
+static long long job_cpu_ns(Job *j) {
+    pid_t pid = j->pid;
+    char path[64];
+    long long ns = -1;
+
+    if (j->cg_fd >= 0 && (ns = cgroup_cpu_ns(j)) >= 0) return ns;
+
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", pid);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%lld", &ns) != 1) ns = -1;
+        fclose(f);
+    }
+    if (ns >= 0) return ns;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    f = fopen(path, "r");
+    if (!f) return -1;
+    unsigned long utime, stime;
+    // skip pid and (comm), comm may contain spaces
+    int ok = fscanf(f, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                    &utime, &stime) == 2;
+    fclose(f);
+    if (!ok) return -1;
+    return (long long)(utime + stime) * (1000000000LL / sysconf(_SC_CLK_TCK));
+}
+
+static void handle_time_slice(void) {
+    current_time_slice++;
+
+    for (int i = 0; i < num_cpu; i++) {
+        int job_idx = slot_job[i];
+        if (job_idx == -1) continue;
+        Job *j = get_job(shared_state, job_idx);
+        if (j->last_slot != i) continue;   // other slot of a gang, handled once
+
+        j->slices_ran++;
+        sync_result(job_idx);
+
+        // quantum not used up yet, keep running without a context switch
+        if (--j->slice_left > 0) {
+            continue;
+        }
+
+        // jobs that did not declare their threads take as many slots as
+        // they run threads now; one that grew gets them at its next dispatch
+        if (j->threads_req == 0) {
+            int n = count_threads(j->pid);
+            if (n > 0) j->threads = n;
+        }
+        int width = job_width(j);
+        if (width < j->nr_slots) shrink_job(job_idx, width);
+
+        // nobody waits for its slots: charge the quantum and grant a new one in place
+        // instead of a SIGSTOP/SIGCONT round trip
+        int waiting = j->nr_slots == 1 ? rq[i].nr_ready : shared_state->nr_ready;
+        if (waiting == 0 && gang_wait == -1 && width == j->nr_slots && kill(j->pid, 0) == 0) {
+            long long cpu = job_cpu_ns(j);
+            if (cpu >= 0) {
+                policy_preempted(shared_state, job_idx, cpu - j->cpu_ns);
+                j->cpu_ns = cpu;
+            }
+            j->slice_granted = j->slice_left = policy_quantum(shared_state, &rq[i], job_idx);
+            j->quantum_sum += j->slice_granted;
+            continue;
+        }
+
+        job_stop(j);
+        release_slots(job_idx);
+
+        int status;
+        struct rusage ru;
+        pid_t r = wait4(j->pid, &status, WNOHANG, &ru);
+
+        if (r == j->pid) {
+            job_exited(job_idx, status, &ru);
+            job_finished(shared_state, job_idx);
+        } else if (kill(j->pid, 0) == -1 && errno == ESRCH) {
+            job_exited(job_idx, -1, NULL);
+            job_finished(shared_state, job_idx);
+        } else {
+            long long cpu = job_cpu_ns(j);
+            long long ran = cpu >= j->cpu_ns ? cpu - j->cpu_ns : 0;
+            if (cpu >= 0) j->cpu_ns = cpu;
+            sync_result(job_idx);
+
+            j->state = READY;
+            j->ready_since_ns = monotonic_ns();
+            policy_preempted(shared_state, job_idx, ran);
+            enqueue(shared_state, &rq[i], job_idx);
+        }
+    }
+
+    policy_slice_end(shared_state, rq, slot_job, num_cpu, current_time_slice);
+    if (current_time_slice % BALANCE_SLICES == 0) rq_balance(shared_state, rq, num_cpu);
+    fill_free_cpus();
 }
 
 void run_scheduler(SharedState *S, int NCPU, int TSLICE) {
     shared_state = S;
     num_cpu = NCPU;
     time_slice_ms = TSLICE;
+    slot_job = malloc(NCPU * sizeof(int));
+    slot_cpu = malloc(NCPU * sizeof(int));
+    rq = malloc(NCPU * sizeof(RunQueue));
+    free_slots = malloc(NCPU * sizeof(int));
+    if (!slot_job || !slot_cpu || !rq || !free_slots) {
+        perror("malloc");
+        exit(1);
+    }
+    assign_slot_cpus();
 
+    if (S->backend == BACKEND_CGROUP && cgroup_init(TSLICE) < 0) {
+        fprintf(stderr, "cgroup v2 not usable, controlling jobs with signals\n");
+        S->backend = BACKEND_SIGNAL;
+    }
+
+    // no SIGCHLD when jobs are stopped, only when they exit
     struct sigaction sa = {0};
-    sa.sa_handler = sigterm_handler;
-    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    // SIGTERM and SIGCHLD are read from a signalfd instead of a handler
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &orig_mask);
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd < 0 || timer_fd < 0 || epoll_fd < 0) {
+        perror("scheduler event setup");
+        exit(1);
+    }
+
+    int fds[] = { timer_fd, signal_fd, S->doorbell_fd };
+    for (int i = 0; i < 3; i++) {
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.fd = fds[i];
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+            perror("epoll_ctl");
+            exit(1);
+        }
+    }
 
     while (!exit_requested) {
+        // submissions made before the loop started rang the doorbell too
         check_for_new_jobs();
+        fill_free_cpus();
+        update_timer();
 
-        if (num_running_jobs == 0 && shared_state->rq_size == 0 && shared_state->njq_size == 0) {
-            usleep(TSLICE * 1000);
-            continue;
+        struct epoll_event events[3];
+        int n = epoll_wait(epoll_fd, events, 3, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
         }
 
-        handle_time_slice();
-        usleep(TSLICE * 1000);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                    continue;
+                // slices missed while we were busy still count
+                current_time_slice += expirations - 1;
+                handle_time_slice();
+            } else if (fd == signal_fd) {
+                struct signalfd_siginfo si;
+                while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+                    if (si.ssi_signo == SIGTERM) exit_requested = 1;
+                }
+                reap_children();
+            } else {
+                uint64_t count;
+                read(S->doorbell_fd, &count, sizeof(count));
+            }
+        }
     }
 
     cleanup_child_processes();
+    cgroup_destroy();
+    close(epoll_fd);
+    close(timer_fd);
+    close(signal_fd);
 }
 
 
 
-static void cleanup_child_processes(void) {
-    if (!shared_state) return;
+// Shutdown: ask every started job that registered checkpoint state to
+// save it, resume them so they reach a sched_checkpoint_point(), and
+// reap them until they are all gone or CHECKPOINT_WAIT_MS has passed
+static void checkpoint_jobs(void) {
+    int pending = 0;
 
     for (int i = 0; i < shared_state->job_count; i++) {
-        if (shared_state->jobs[i].state != DONE) {
-            kill(shared_state->jobs[i].pid, SIGKILL);
-            waitpid(shared_state->jobs[i].pid, NULL, 0);
-            shared_state->jobs[i].state = DONE;
-            shared_state->jobs[i].completion_slice = current_time_slice;
+        Job *j = get_job(shared_state, i);
+        if (j->state == DONE || !j->started) continue;
+        JobResult *r = j->own_result;
+        int expected = CKPT_READY;
+        if (!r || !atomic_compare_exchange_strong(&r->checkpoint, &expected, CKPT_REQUESTED))
+            continue;
+        if (pending == 0 && mkdir(shared_state->ckpt_dir, 0755) < 0 && errno != EEXIST) {
+            perror(shared_state->ckpt_dir);
+            atomic_store(&r->checkpoint, CKPT_READY);
+            return;
+        }
+        job_cont(j);
+        pending++;
+    }
+
+    long long deadline = monotonic_ns() + CHECKPOINT_WAIT_MS * 1000000LL;
+    while (pending > 0) {
+        int status;
+        struct rusage ru;
+        pid_t pid;
+        while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+            for (int i = 0; i < shared_state->job_count; i++) {
+                Job *j = get_job(shared_state, i);
+                if (j->pid != pid || j->state == DONE) continue;
+                j->state = DONE;
+                if (j->own_result && atomic_load(&j->own_result->checkpoint) == CKPT_REQUESTED) pending--;
+                job_exited(i, status, &ru);
+                // a new checkpoint supersedes the one it was restored from
+                if (WIFEXITED(status) && WEXITSTATUS(status) == CHECKPOINT_EXIT) j->exit_status = EXIT_CHECKPOINTED;
+                drop_restore(j);
+                break;
+            }
+        }
+
+        long long left = deadline - monotonic_ns();
+        if (pending == 0 || left <= 0) break;
+        struct pollfd pfd = { signal_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, left / 1000000 + 1) > 0) {
+            struct signalfd_siginfo si;
+            while (read(signal_fd, &si, sizeof(si)) == sizeof(si));
         }
     }
 }
 
-void print_report(SharedState *S, int TSLICE) {
-    printf("\nExecution Report:\n");
-    printf("%-20s\t%-10s\t%-15s\t\t%-15s\n", "Name", "PID", "Turnaround Time", "Wait Time");
+static void cleanup_child_processes(void) {
+    if (!shared_state) return;
+
+    checkpoint_jobs();
 
-    for (int i = 0; i < S->job_count; i++) {
-        Job j = S->jobs[i];
-        int wait_time_ms = j.slices_waited ;
-        int turnaround_time_ms;
-
-        if (j.state == DONE) {
-            turnaround_time_ms = (j.completion_slice - j.submission_slice);
-            if (turnaround_time_ms < 0 || turnaround_time_ms > 60000)
-                turnaround_time_ms = j.slices_ran ;
-        } else {
-            turnaround_time_ms = j.slices_ran;
+    for (int i = 0; i < shared_state->job_count; i++) {
+        Job *j = get_job(shared_state, i);
+        if (j->state != DONE) {
+            int status;
+            struct rusage ru;
+            if (j->cg_fd >= 0) {
+                cgroup_kill(j);
+            } else {
+                kill(j->pid, SIGKILL);
+            }
+            wait4(j->pid, &status, 0, &ru);
+            j->state = DONE;
+            job_exited(i, status, &ru);
+            j->exit_status = EXIT_KILLED;
         }
+    }
 
-        printf("%-20s\t%-10d\t%-5d TSLICES\t\t%-5d TSLICES\n",
-               j.name, j.pid, turnaround_time_ms, wait_time_ms);
+    int n = checkpoint_save(shared_state);
+    if (n > 0) {
+        printf("%d job%s saved to %s, submitted again at the next start\n", n, n == 1 ? "" : "s",
+               shared_state->ckpt_dir);
+        fflush(stdout);
     }
-    fflush(stdout);
 }
-
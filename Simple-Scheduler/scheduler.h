@@ -1,39 +1,241 @@
 #include <sys/types.h>
+#include <stdatomic.h>
+#include "job_result.h"
 
-#define MAX_JOBS 100
+#define JOB_TABLE_INIT 100   // initial job table slots, the table grows on demand
+#define MAX_PENDING 128      // submissions waiting for the scheduler, power of two
+#define MAX_JOB_ARGS 32      // arguments passed to a job after its path
+#define MAX_DEPS 8           // jobs a submission can wait for
 
 // Job states
 #define READY   0
 #define RUNNING 1
 #define DONE    2
+#define BLOCKED 3            // waiting for the jobs it depends on
+
+#define EXIT_CANCELLED -2    // exit_status of a job dropped because a dependency failed
+#define EXIT_CHECKPOINTED -3 // exit_status of a job that saved a checkpoint at shutdown
+#define EXIT_KILLED -4       // exit_status of a job killed at shutdown
+
+#define CHECKPOINT_WAIT_MS 3000   // how long jobs get to save a checkpoint at shutdown
+#define CKPT_KEY_LEN 32           // "<session>-<id>", names a checkpoint file
+#define CKPT_SESSION_LEN 20
+
+// Scheduling policies, chosen when the shell starts
+#define POLICY_RR   0      // round-robin over a single ready queue (default)
+#define POLICY_MLFQ 1      // multi-level feedback queue
+#define POLICY_CFS  2      // fair share by weighted virtual runtime
+
+// How jobs are paused and resumed
+#define BACKEND_SIGNAL 0   // SIGSTOP / SIGCONT to the job's main process
+#define BACKEND_CGROUP 1   // one cgroup v2 per job, cgroup.freeze (cgroup.c)
+
+#define BALANCE_SLICES 4       // run queues are rebalanced this often
+
+#define MLFQ_LEVELS 4
+#define MLFQ_BOOST_SLICES 50   // every job goes back to its base level this often
+
+// Quanta are counted in TSLICE ticks
+#define MAX_QUANTUM 64         // largest per-job quantum accepted by submit
+#define MAX_THREADS 1024       // largest thread count accepted by submit
+#define ADAPT_MAX_QUANTUM 8    // adaptive mode grows CPU-bound jobs up to this
+
+// Priorities are nice-style: lower runs first, 0 is the default
+#define PRIO_MIN -20
+#define PRIO_MAX 19
 
 typedef struct {
     pid_t pid;
+    int id;                // submission id, unique for the whole session
     char name[256];
-    int state;             // READY, RUNNING, DONE
+    int state;             // READY, RUNNING, DONE, BLOCKED
     int started;           // 0 = never started, 1 = already started
-    int completion_slice;  // slice when finished
-    int slices_ran;
-    int submission_slice;
-    int slices_waited;    // total slices spent waiting
+    int slices_ran;        // ticks spent on a CPU
+    // timestamps are CLOCK_MONOTONIC nanoseconds, see monotonic_ns()
+    long long submit_ns;      // taken by the submitter
+    long long first_run_ns;   // 0 = never ran
+    long long completion_ns;
+    long long ready_since_ns; // when it last entered the ready queue
+    long long wait_ns;        // total time spent ready but not running
+    long long user_ns;        // CPU time from the wait4() rusage
+    long long sys_ns;
+    int exit_status;          // raw wait status, -1 until it is reaped
+    int priority;          // from submit, PRIO_MIN..PRIO_MAX
+    int level;             // current MLFQ level, 0 = highest
+    long long cpu_ns;      // CPU time consumed, sampled when the job is stopped
+    long long vruntime;    // POLICY_CFS: cpu time scaled by the priority weight
+    int quantum;           // ticks per dispatch from submit, 0 = policy default
+    int adapt_quantum;     // adaptive mode: current quantum of this job
+    int slice_granted;     // ticks granted at the last dispatch
+    int slice_left;        // ticks left before the job is preempted
+    int switches;          // times the job was resumed (SIGCONT)
+    long long quantum_sum; // ticks granted over all dispatches
+    int last_slot;         // scheduler slot it last ran on, -1 = never ran
+    int cpu;               // CPU it is pinned to, -1 = not pinned yet
+    int migrations;        // times it was resumed on a different CPU
+    int cg_fd;             // scheduler's fd on its cgroup.freeze, -1 = signals
+    int cg_cpus;           // CPUs its cpu.max allows
+    int threads_req;       // threads declared at submit, 0 = count /proc/<pid>/task
+    int threads;           // threads it runs, slots it takes when dispatched (capped at NCPU)
+    int nr_slots;          // slots held while running, 0 otherwise
+    char restore[CKPT_KEY_LEN];   // checkpoint it was restored from, "" = none
+    JobResult *own_result;  // scheduler's mapping of the job's own result page, NULL once it ended
+    unsigned result_seq;    // own_result->seq last copied to the shared slot
+    int deps_left;         // predecessors that have not finished yet
+    int after[MAX_DEPS];   // ids of its predecessors, as submitted
+    int nafter;
+    char path[256];        // path and arguments as submitted, like in JobRequest
+    char args[256];
+    int nargs;
+    int next;              // link for the ready/done queues, -1 = end
 } Job;
 
+// FIFO of job slots linked through Job.next
+typedef struct {
+    int head, tail, size;
+} JobQueue;
+
+// Lock-free single-producer / single-consumer ring for submissions: only
+// the shell advances head, only the scheduler advances tail. Slots in
+// [tail, head) are filled.
+typedef struct {
+    int id;                // from next_job_id, see submit_id()
+    char path[256];        // "" = an id the submitter dropped, it only fails its dependents
+    char args[256];        // nargs NUL-terminated arguments, back to back
+    int nargs;
+    int after[MAX_DEPS];   // ids that must finish successfully first
+    int nafter;
+    int priority;
+    int quantum;           // ticks, 0 = policy default
+    int threads;           // CPU slots the job needs, 0 = detect
+    char restore[CKPT_KEY_LEN];   // checkpoint to resume from, "" = start fresh
+    long long submit_ns;
+} JobRequest;
+
+typedef struct {
+    atomic_uint head;      // next position to fill (shell)
+    atomic_uint tail;      // next position to consume (scheduler)
+    JobRequest slots[MAX_PENDING];
+} SubmitQueue;
+
 typedef struct {
-    Job jobs[MAX_JOBS];
-    int job_count;
+    // The job table lives in a memfd (job_fd) so it can grow after the
+    // shell and scheduler have forked; use get_job() to access it.
+    int job_fd;
+    int job_capacity;
+    int result_fd;         // memfd of the job result slots, one per job slot, see get_result()
+    int job_count;         // slots handed out so far, <= job_capacity
 
-    int ready_q[MAX_JOBS];
-    int rq_head, rq_tail, rq_size;
+    int policy;            // POLICY_RR, POLICY_MLFQ or POLICY_CFS
+    int adaptive;          // adapt quanta to the job and the ready queue length
+    int backend;           // BACKEND_SIGNAL or BACKEND_CGROUP, falls back to signals
+    int ncpu;
+    int tslice_ms;
+    int nr_ready;          // jobs waiting in all run queues, the queues are scheduler-local
+    int last_boost;        // POLICY_MLFQ: slice of the last boost
+    unsigned int place_rng;   // xorshift state of rq_place(), seeded by policy_init()
+    JobQueue done_q;       // finished jobs, oldest first, recycled when the table is full
 
-    char new_job_q[MAX_JOBS][256];
-    int njq_head, njq_tail, njq_size;
+    // totals (ns) of finished jobs whose slot has been recycled
+    int retired_jobs;
+    long long retired_turnaround;
+    long long retired_wait;
+    long long retired_response;
+
+    SubmitQueue new_job_q;
+    int doorbell_fd;       // eventfd, bumped on every submission to wake the scheduler
+    atomic_int jobs_ended; // submissions reaped or dropped by the scheduler
+    atomic_int next_job_id;   // ids handed out to submissions, starting at 1
+
+    // checkpoints written at shutdown, see cleanup_child_processes()
+    char ckpt_dir[256];
+    char session[CKPT_SESSION_LEN];   // unique per shell start, prefix of the checkpoint keys
 
 } SharedState;
 
+// One run queue per scheduler slot, every ready job is on exactly one
+typedef struct {
+    int nr_ready;
+    JobQueue ready_q;                // POLICY_RR
+    JobQueue level_q[MLFQ_LEVELS];   // POLICY_MLFQ
+    int *heap;                       // POLICY_CFS, min-heap of job slots by vruntime
+    int heap_size, heap_cap;
+    long long min_vruntime;          // POLICY_CFS, vruntimes only compare within a queue
+} RunQueue;
+
+// Job table
+int job_table_init(SharedState *S);
+void job_table_destroy(SharedState *S);
+Job *get_job(SharedState *S, int idx);
+int find_job(SharedState *S, int id);         // slot of job id, -1 if it was recycled or never started
+JobResult *get_result(SharedState *S, int idx);
+int read_result(SharedState *S, int idx, int id, char *buf);   // bytes copied to buf, -1 if not readable
+
 // Queue operations
-void enqueue(SharedState *S, int idx);
-int dequeue(SharedState *S);
+void queue_init(JobQueue *q);
+void queue_push(SharedState *S, JobQueue *q, int idx);
+int queue_pop(SharedState *S, JobQueue *q);
+
+// Run queues, dispatched to the policy in S->policy (policy.c)
+void policy_init(SharedState *S, int policy, int adaptive, int ncpu, int tslice_ms);
+const char *policy_name(int policy);
+int policy_from_name(const char *name);          // -1 if unknown
+void runqueue_init(RunQueue *rq);
+void runqueue_destroy(RunQueue *rq);
+void enqueue(SharedState *S, RunQueue *rq, int idx);
+int dequeue(SharedState *S, RunQueue *rq);
+void policy_job_init(SharedState *S, RunQueue *rq, Job *j);
+void policy_preempted(SharedState *S, int idx, long long ran_ns);   // job used its whole slice
+void policy_slice_end(SharedState *S, RunQueue *rqs, const int *running, int n, int slice);
+int policy_quantum(SharedState *S, RunQueue *rq, int idx);          // ticks to grant on dispatch
+
+// Load balancing over the n run queues
+int rq_place(SharedState *S, RunQueue *rqs, int n);           // queue for a new job
+int rq_steal(SharedState *S, RunQueue *rqs, int n, int to);   // job taken for idle slot `to`, -1 = none
+int rq_balance(SharedState *S, RunQueue *rqs, int n);         // jobs moved
+
+// Submission queue, one submitter (the shell) and one consumer (the scheduler)
+int submit_queue_init(SharedState *S);
+int submit_push(SharedState *S, const JobRequest *req);   // 0 ok, -1 full
+int submit_push_batch(SharedState *S, const JobRequest *reqs, int n);   // number queued
+int submit_pop(SharedState *S, JobRequest *req);          // 0 ok, -1 empty
+int submit_pending(SharedState *S);
+int submit_id(SharedState *S, int n);    // reserves n consecutive ids, returns the first
+
+// Job dependencies (deps.c), used by the scheduler only
+int deps_add(SharedState *S, int idx, const int *after, int n);   // predecessors left, -1 = one failed
+void deps_done(SharedState *S, int idx, int ok, void (*release)(int idx), void (*cancel)(int idx));
+void deps_drop(SharedState *S, int id, void (*cancel)(int idx));
+int deps_succeeded(int id);
+
+// cgroup v2 job control (cgroup.c), used by the scheduler only
+int cgroup_init(int tslice_ms);                   // 0 ok, -1 no usable cgroup v2
+int cgroup_has_cpu(void);                         // cpu.max / cpu.weight in effect
+void cgroup_destroy(void);
+int cgroup_attach(Job *j);                        // new job, starts frozen; -1 = use signals
+void cgroup_detach(Job *j);
+int cgroup_freeze(Job *j, int frozen);
+void cgroup_set_cpus(Job *j, int n);              // cpu.max of n CPUs, for jobs running on n slots
+void cgroup_kill(Job *j);
+long long cgroup_cpu_ns(Job *j);                  // whole job, -1 if unknown
+
+// Checkpoints (checkpoint.c)
+void checkpoint_init(SharedState *S);    // directory from $SCHED_CHECKPOINT_DIR, new session
+void checkpoint_key(SharedState *S, int id, char *key);   // key of job id, CKPT_KEY_LEN bytes
+void checkpoint_path(SharedState *S, const char *key, char *buf, size_t len);
+void checkpoint_manifest(SharedState *S, char *buf, size_t len);   // jobs to restore, in submit syntax
+int checkpoint_save(SharedState *S);     // manifest of the checkpointed jobs, returns how many
 
 // Scheduler
+long long monotonic_ns(void);
 void run_scheduler(SharedState *S, int NCPU, int TSLICE);
+
+// Report (report.c), times in ms
+typedef struct {
+    double p50, p95, p99, mean;
+} Summary;
+
 void print_report(SharedState *S, int TSLICE);
+int print_job_status(SharedState *S, int TSLICE, int id);   // -1 if id is not in the job table
+int report_summary(SharedState *S, int TSLICE, Summary *turnaround, Summary *wait, Summary *response);   // finished jobs
+int export_report(SharedState *S, int TSLICE, const char *path);   // .csv or .json
@@ -0,0 +1,11 @@
+#include <stdlib.h>
+
+#include "dummy_main.h"
+
+// a job that only spins for argv[1] iterations, used by make check
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 1000;
+    volatile long s = 0;
+    for (long i = 0; i < n; i++) s += i;
+    return 0;
+}
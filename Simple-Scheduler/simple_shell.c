@@ -6,6 +6,7 @@
 #include <sys/wait.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <time.h>
 #include "scheduler.h"
 
 #define MAX_LINE 1024
@@ -14,42 +15,334 @@ static pid_t sched_pid = -1;
 static SharedState *g_shared_state = NULL;
 static int g_tslice = 0;
 
+// Words are separated by blanks. Double quotes keep blanks in a word,
+// and inside them \" and \\ stand for " and \.
 void parse_command(char *line, char **args) {
     char *newline = strchr(line, '\n');
     if (newline) *newline = '\0';
 
     int i = 0;
-    char *token = strtok(line, " \t");
-    while (token != NULL && i < MAX_LINE / 2) {
-        args[i++] = token;
-        token = strtok(NULL, " \t");
+    char *p = line;
+    while (i < MAX_LINE / 2) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0') break;
+
+        // unquote in place, the word never gets longer
+        char *out = p;
+        int quoted = 0;
+        args[i++] = p;
+        while (*p && (quoted || (*p != ' ' && *p != '\t'))) {
+            if (*p == '"') {
+                quoted = !quoted;
+                p++;
+                continue;
+            }
+            if (quoted && *p == '\\' && (p[1] == '"' || p[1] == '\\')) p++;
+            *out++ = *p++;
+        }
+        if (*p) p++;
+        *out = '\0';
     }
     args[i] = NULL;
 }
 
-void submit_job(SharedState *S, const char *path) {
-    if (S->njq_size >= MAX_JOBS) {
+// "[-r key] [-q ticks] [-t threads] <path> [prio] [after <id,...>] [-- args...]" into req; prints
+// the error and returns -1 if invalid. Dependency ids are kept as written,
+// see resolve_after().
+int parse_submit(char **args, JobRequest *req) {
+    memset(req, 0, sizeof(*req));
+
+    int a = 0;
+    while (args[a] && (strcmp(args[a], "-q") == 0 || strcmp(args[a], "-t") == 0 ||
+                       strcmp(args[a], "-r") == 0)) {
+        int v = args[a + 1] ? atoi(args[a + 1]) : 0;
+        if (args[a][1] == 'r') {
+            // resume from a checkpoint, written by the scheduler into the restore manifest
+            const char *key = args[a + 1] ? args[a + 1] : "";
+            if (!*key || strlen(key) >= sizeof(req->restore) || strchr(key, '/')) {
+                printf("Error: bad checkpoint key '%s'\n", key);
+                return -1;
+            }
+            strcpy(req->restore, key);
+        } else if (args[a][1] == 'q') {
+            // optional fixed quantum for this job, in TSLICE ticks
+            req->quantum = v;
+            if (req->quantum <= 0 || req->quantum > MAX_QUANTUM) {
+                printf("Error: quantum must be between 1 and %d ticks\n", MAX_QUANTUM);
+                return -1;
+            }
+        } else {
+            // threads the job runs, it is given as many CPU slots
+            req->threads = v;
+            if (req->threads <= 0 || req->threads > MAX_THREADS) {
+                printf("Error: threads must be between 1 and %d\n", MAX_THREADS);
+                return -1;
+            }
+        }
+        a += args[a + 1] ? 2 : 1;
+    }
+
+    if (args[a] == NULL || strcmp(args[a], "--") == 0) {
+        printf("Usage: submit [-q ticks] [-t threads] <path_to_executable> [prio] [after <id,...>] [-- args...]\n");
+        return -1;
+    }
+    strncpy(req->path, args[a++], sizeof(req->path) - 1);
+
+    if (args[a] && strcmp(args[a], "--") != 0 && strcmp(args[a], "after") != 0) {
+        char *end;
+        req->priority = strtol(args[a++], &end, 10);
+        if (*end != '\0' || req->priority < PRIO_MIN || req->priority > PRIO_MAX) {
+            printf("Error: priority must be between %d and %d\n", PRIO_MIN, PRIO_MAX);
+            return -1;
+        }
+    }
+
+    if (args[a] && strcmp(args[a], "after") == 0) {
+        char *list = args[a + 1];
+        a += list ? 2 : 1;
+        for (char *tok = list ? strtok(list, ",") : NULL; tok; tok = strtok(NULL, ",")) {
+            char *end;
+            long id = strtol(tok, &end, 10);
+            if (*end != '\0' || id == 0 || req->nafter == MAX_DEPS) {
+                printf("Error: 'after' takes up to %d job ids separated by commas\n", MAX_DEPS);
+                return -1;
+            }
+            req->after[req->nafter++] = id;
+        }
+        if (req->nafter == 0) {
+            printf("Error: 'after' needs a list of job ids\n");
+            return -1;
+        }
+    }
+
+    if (args[a] == NULL) return 0;
+    if (strcmp(args[a], "--") != 0) {
+        printf("Error: unexpected '%s', job arguments go after --\n", args[a]);
+        return -1;
+    }
+    int len = 0;
+    for (a++; args[a]; a++) {
+        int n = strlen(args[a]) + 1;
+        if (req->nargs == MAX_JOB_ARGS || len + n > (int)sizeof(req->args)) {
+            printf("Error: too many job arguments\n");
+            return -1;
+        }
+        memcpy(req->args + len, args[a], n);
+        len += n;
+        req->nargs++;
+    }
+    return 0;
+}
+
+// Once req->id is known: negative dependencies count back from it
+// (-1 is the job submitted just before), and every dependency has to be
+// an earlier job, which keeps the graph free of cycles
+static int resolve_after(JobRequest *req) {
+    for (int i = 0; i < req->nafter; i++) {
+        int dep = req->after[i] < 0 ? req->id + req->after[i] : req->after[i];
+        if (dep < 1 || dep >= req->id) {
+            printf("Error: job %d can only depend on earlier jobs (got %d)\n", req->id, req->after[i]);
+            return -1;
+        }
+        req->after[i] = dep;
+    }
+    return 0;
+}
+
+void submit_job(SharedState *S, JobRequest *req) {
+    // only take an id when it can be queued, a lost id would block
+    // every job that names it
+    if (submit_pending(S) >= MAX_PENDING) {
         printf("Error: Job submission queue is full.\n");
         return;
     }
-    if (S->job_count + S->njq_size >= MAX_JOBS) {
-        printf("Error: Maximum total jobs (%d) will be exceeded.\n", MAX_JOBS);
+    req->id = submit_id(S, 1);
+    req->submit_ns = monotonic_ns();
+    if (resolve_after(req) < 0) {
+        // the scheduler still hears of the id, as a failed job
+        req->path[0] = '\0';
+        submit_push(S, req);
         return;
     }
 
-    strncpy(S->new_job_q[S->njq_tail], path, sizeof(S->new_job_q[0]) - 1);
-    S->new_job_q[S->njq_tail][sizeof(S->new_job_q[0]) - 1] = '\0';
+    if (submit_push(S, req) < 0) {
+        printf("Error: Job submission queue is full.\n");
+        return;
+    }
+
+    printf("Job submitted: %s (id %d)\n", req->path, req->id);
+}
+
+// One submission per line, with the syntax of submit; lines starting with
+// # are comments. In a trace (timed) every line starts with the arrival
+// time in ms. Returns the number of requests, -1 if the file can't be read.
+// The jobs get consecutive ids, so "after -1" names the previous job.
+// Jobs with bad dependencies stay in the list with an empty path and are
+// counted in *dropped.
+static int read_requests(SharedState *S, const char *file, int timed, JobRequest **reqs, double **arrival, int *dropped) {
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        perror(file);
+        return -1;
+    }
+
+    char line[MAX_LINE];
+    char *args[MAX_LINE / 2 + 1];
+    int n = 0, cap = 0, lineno = 0;
+    *reqs = NULL;
+    *arrival = NULL;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        parse_command(line, args);
+        if (args[0] == NULL || args[0][0] == '#') continue;
+
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            *reqs = realloc(*reqs, cap * sizeof(JobRequest));
+            *arrival = realloc(*arrival, cap * sizeof(double));
+            if (!*reqs || !*arrival) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+
+        char **spec = args;
+        double at = 0;
+        if (timed) {
+            char *end;
+            at = strtod(args[0], &end);
+            if (*end != '\0' || at < 0) {
+                printf("%s:%d: bad arrival time '%s'\n", file, lineno, args[0]);
+                continue;
+            }
+            spec++;
+        }
+        if (parse_submit(spec, &(*reqs)[n]) < 0) {
+            printf("%s:%d: line skipped\n", file, lineno);
+            continue;
+        }
+        (*arrival)[n++] = at;
+    }
+    fclose(f);
+
+    // one id per job in file order, so relative references stay as
+    // written; a dropped job is still queued so its dependents fail too
+    int first = n ? submit_id(S, n) : 0;
+    *dropped = 0;
+    for (int i = 0; i < n; i++) {
+        (*reqs)[i].id = first + i;
+        if (resolve_after(&(*reqs)[i]) < 0) {
+            (*reqs)[i].path[0] = '\0';
+            (*dropped)++;
+        }
+    }
+    return n;
+}
+
+// Queue n requests in as few ring operations as possible, waiting for
+// the scheduler whenever the ring is full
+static void push_all(SharedState *S, JobRequest *reqs, int n) {
+    int done = 0;
+    while (done < n) {
+        int k = submit_push_batch(S, reqs + done, n - done);
+        if (k == 0) usleep(1000);
+        done += k;
+    }
+}
+
+// returns the number of requests queued, dropped jobs included since
+// the scheduler counts those in jobs_ended as well
+int submit_batch(SharedState *S, const char *file) {
+    JobRequest *reqs;
+    double *arrival;
+    int dropped;
+    int n = read_requests(S, file, 0, &reqs, &arrival, &dropped);
+    if (n < 0) return 0;
+
+    long long now = monotonic_ns();
+    for (int i = 0; i < n; i++) reqs[i].submit_ns = now;
+    push_all(S, reqs, n);
+    printf("%d jobs submitted from %s\n", n - dropped, file);
+
+    free(reqs);
+    free(arrival);
+    return n;
+}
+
+// Non-interactive mode: submit every job of the trace at its arrival time
+// (ms after the start of the replay), then wait until all of them ended.
+// Jobs arriving at the same time go in as one batch. The earlier jobs
+// submitted since jobs_ended was base (restored checkpoints) are waited
+// for as well, so their ends are not counted as trace jobs.
+void replay_trace(SharedState *S, const char *file, int base, int earlier) {
+    JobRequest *reqs;
+    double *arrival;
+    int dropped;
+    int n = read_requests(S, file, 1, &reqs, &arrival, &dropped);
+    if (n < 0) return;
+
+    long long t0 = monotonic_ns();
+    int i = 0;
+    while (i < n) {
+        long long at = t0 + (long long)(arrival[i] * 1000000.0);
+        struct timespec ts = { at / 1000000000LL, at % 1000000000LL };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        // submission time is the arrival time, so a full ring counts as waiting
+        int k = i;
+        while (k < n && arrival[k] == arrival[i]) reqs[k++].submit_ns = at;
+        push_all(S, reqs + i, k - i);
+        i = k;
+    }
+
+    while (atomic_load(&S->jobs_ended) - base < earlier + n) {
+        usleep(10 * 1000);
+    }
+    double secs = (monotonic_ns() - t0) / 1e9;
+    printf("Replayed %d jobs from %s in %.3f s (%.2f jobs/s)\n", n - dropped, file, secs, (n - dropped) / secs);
 
-    S->njq_tail = (S->njq_tail + 1) % MAX_JOBS;
-    S->njq_size++;
+    free(reqs);
+    free(arrival);
+}
+
+// why job id has no slot in the job table
+static void job_missing(SharedState *S, int id) {
+    if (id < 1 || id >= atomic_load(&S->next_job_id)) {
+        printf("Error: no job with id %d\n", id);
+    } else {
+        printf("Job %d is not in the job table (not started yet or slot recycled)\n", id);
+    }
+}
 
-    printf("Job submitted: %s\n", path);
+void show_status(SharedState *S, const char *arg) {
+    int id = atoi(arg);
+    if (print_job_status(S, g_tslice, id) < 0) job_missing(S, id);
+}
+
+// print what the job stored with sched_result_set()/sched_result_printf()
+void show_result(SharedState *S, const char *arg) {
+    int id = atoi(arg);
+    int idx = find_job(S, id);
+    if (idx == -1) {
+        job_missing(S, id);
+        return;
+    }
+
+    char buf[RESULT_MAX];
+    int len = read_result(S, idx, id, buf);
+    if (len < 0) {
+        printf("Error: result of job %d could not be read\n", id);
+        return;
+    }
+    fwrite(buf, 1, len, stdout);
+    if (len > 0 && buf[len - 1] != '\n') putchar('\n');
 }
 
 void cleanup_and_exit() {
     if (sched_pid > 0) {
         int waited_ms = 0;
-        while (g_shared_state && g_shared_state->njq_size > 0 && waited_ms < 1000) {
+        while (g_shared_state && submit_pending(g_shared_state) > 0 && waited_ms < 1000) {
             usleep(100 * 1000); // 100 ms
             waited_ms += 100;
         }
@@ -63,6 +356,8 @@ void cleanup_and_exit() {
 
     if (g_shared_state != NULL) {
         print_report(g_shared_state, g_tslice);
+        job_table_destroy(g_shared_state);
+        close(g_shared_state->doorbell_fd);
         munmap(g_shared_state, sizeof(SharedState));
         g_shared_state = NULL;
     }
@@ -77,11 +372,31 @@ void sigint_handler(int signum) {
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <NCPU> <TSLICE(ms)>\n", argv[0]);
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <NCPU> <TSLICE(ms)> [rr|mlfq|cfs] [adaptive] [cgroup] [replay <trace>]\n", argv[0]);
         return 1;
     }
 
+    // options after NCPU and TSLICE, in any order
+    int policy = POLICY_RR;
+    int adaptive = 0;
+    int backend = BACKEND_SIGNAL;
+    const char *trace = NULL;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "replay") == 0 && i + 1 < argc) {
+            trace = argv[++i];
+        } else if (strcmp(argv[i], "adaptive") == 0) {
+            adaptive = 1;
+        } else if (strcmp(argv[i], "cgroup") == 0) {
+            backend = BACKEND_CGROUP;
+        } else if (policy_from_name(argv[i]) >= 0) {
+            policy = policy_from_name(argv[i]);
+        } else {
+            fprintf(stderr, "Error: unknown option '%s' (rr, mlfq, cfs, adaptive, cgroup, replay <trace>)\n", argv[i]);
+            return 1;
+        }
+    }
+
     int NCPU = atoi(argv[1]);
     int TSLICE = atoi(argv[2]);
     g_tslice = TSLICE;
@@ -99,6 +414,13 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     memset(S, 0, sizeof(SharedState));
+    policy_init(S, policy, adaptive, NCPU, TSLICE);
+    checkpoint_init(S);
+    S->backend = backend;
+    if (submit_queue_init(S) < 0 || job_table_init(S) < 0) {
+        munmap(S, sizeof(SharedState));
+        return 1;
+    }
     g_shared_state = S;
 
     struct sigaction sa = {0};
@@ -108,6 +430,7 @@ int main(int argc, char *argv[]) {
     sched_pid = fork();
     if (sched_pid < 0) {
         perror("fork for scheduler failed");
+        job_table_destroy(S);
         munmap(S, sizeof(SharedState));
         return 1;
     }
@@ -118,11 +441,29 @@ int main(int argc, char *argv[]) {
         _exit(0);
     }
 
+    // jobs checkpointed when the last scheduler shut down
+    char manifest[300];
+    int base = atomic_load(&S->jobs_ended);
+    int restored = 0;
+    checkpoint_manifest(S, manifest, sizeof(manifest));
+    if (access(manifest, R_OK) == 0) {
+        printf("Restoring checkpointed jobs: ");
+        restored = submit_batch(S, manifest);
+        unlink(manifest);
+    }
+
+    if (trace) {
+        replay_trace(S, trace, base, restored);
+        cleanup_and_exit();
+        return 0;
+    }
+
     char input_line[MAX_LINE];
     char *args[MAX_LINE / 2 + 1];
 
     printf("Simple Job Scheduler Shell\n");
-    printf("Commands: submit <path>, exit \n\n");
+    printf("Policy: %s%s\n", policy_name(policy), adaptive ? " (adaptive quanta)" : "");
+    printf("Commands: submit [-q ticks] [-t threads] <path> [prio] [after <id,...>] [-- args...], submit-batch <file>, status <id>, result <id>, report [file.csv|file.json], exit \n\n");
 
     while (1) {
         printf("SimpleShell$ ");
@@ -143,10 +484,37 @@ int main(int argc, char *argv[]) {
             break;
         }
         else if (strcmp(args[0], "submit") == 0) {
+            JobRequest req;
+            if (parse_submit(args + 1, &req) == 0) {
+                submit_job(S, &req);
+            }
+        }
+        else if (strcmp(args[0], "submit-batch") == 0) {
+            if (args[1] == NULL) {
+                printf("Usage: submit-batch <file>\n");
+            } else {
+                submit_batch(S, args[1]);
+            }
+        }
+        else if (strcmp(args[0], "status") == 0) {
+            if (args[1] == NULL) {
+                printf("Usage: status <id>\n");
+            } else {
+                show_status(S, args[1]);
+            }
+        }
+        else if (strcmp(args[0], "result") == 0) {
             if (args[1] == NULL) {
-                printf("Usage: submit <path_to_executable>\n");
+                printf("Usage: result <id>\n");
             } else {
-                submit_job(S, args[1]);
+                show_result(S, args[1]);
+            }
+        }
+        else if (strcmp(args[0], "report") == 0) {
+            if (args[1] == NULL) {
+                print_report(S, TSLICE);
+            } else if (export_report(S, TSLICE, args[1]) == 0) {
+                printf("Report written to %s\n", args[1]);
             }
         }
         else {
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "scheduler.h"
+
+/*
+ * Discrete-event simulation of the scheduler. The ready queues, quanta
+ * and priorities are the real policy code from policy.c; only the jobs
+ * are synthetic and time is virtual, so a whole workload is evaluated in
+ * milliseconds. The tick handling mirrors handle_time_slice() in
+ * scheduler.c: a slice timer that only runs while there is work, quanta
+ * renewed in place when nobody waits, exited jobs replaced at once.
+ *
+ * A job is an arrival time, an amount of CPU work and the share of a CPU
+ * it uses while it holds a slot (100% = CPU bound, less = it blocks on
+ * I/O for the rest, still holding its slot as real jobs do).
+ */
+
+#define NS_PER_MS 1000000LL
+#define EPOCH_NS NS_PER_MS   // virtual clock start, a 0 timestamp means "never" in Job
+#define IO_SHARE 20          // CPU share (%) of generated I/O-bound jobs
+
+typedef struct {
+    long long arrival_ns;
+    long long work_ns;
+    int priority;
+    int share;               // percent of a CPU used while running
+} SimJob;
+
+typedef struct {
+    int ended;
+    long long makespan_ns;
+    long long switches;
+    long long migrations;
+} SimResult;
+
+static int ncpu, tslice_ms;
+
+static double exp_sample(double mean) {
+    double u = drand48();
+    if (u < 1e-12) u = 1e-12;
+    return -mean * log(u);
+}
+
+// Poisson arrivals, exponential CPU demand, uniform priorities in
+// [-prio, prio] and io_pct percent of I/O-bound jobs
+static SimJob *generate(int n, double arrival_ms, double burst_ms, int prio, int io_pct, long seed) {
+    SimJob *jobs = malloc(n * sizeof(SimJob));
+    if (!jobs) {
+        perror("malloc");
+        exit(1);
+    }
+    srand48(seed);
+
+    double t = 0;
+    for (int i = 0; i < n; i++) {
+        if (i > 0) t += exp_sample(arrival_ms);
+        double work = exp_sample(burst_ms);
+        if (work < 0.1) work = 0.1;
+        jobs[i].arrival_ns = (long long)(t * NS_PER_MS);
+        jobs[i].work_ns = (long long)(work * NS_PER_MS);
+        jobs[i].priority = prio ? (int)(drand48() * (2 * prio + 1)) - prio : 0;
+        jobs[i].share = drand48() * 100 < io_pct ? IO_SHARE : 100;
+    }
+    return jobs;
+}
+
+// "<arrival_ms> <cpu_ms> [prio] [cpu%]" per line, # starts a comment
+static SimJob *load_trace(const char *file, int *n) {
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        perror(file);
+        exit(1);
+    }
+
+    SimJob *jobs = NULL;
+    int cap = 0, lineno = 0;
+    char line[256];
+    *n = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        double at, work;
+        int prio = 0, share = 100;
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+        if (sscanf(p, "%lf %lf %d %d", &at, &work, &prio, &share) < 2 || at < 0 || work <= 0 ||
+            prio < PRIO_MIN || prio > PRIO_MAX || share < 1 || share > 100) {
+            fprintf(stderr, "%s:%d: bad line, skipped\n", file, lineno);
+            continue;
+        }
+        if (*n == cap) {
+            cap = cap ? cap * 2 : 64;
+            jobs = realloc(jobs, cap * sizeof(SimJob));
+            if (!jobs) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        jobs[*n].arrival_ns = (long long)(at * NS_PER_MS);
+        jobs[*n].work_ns = (long long)(work * NS_PER_MS);
+        jobs[*n].priority = prio;
+        jobs[*n].share = share;
+        (*n)++;
+    }
+    fclose(f);
+    return jobs;
+}
+
+static int cmp_arrival(const void *a, const void *b) {
+    long long x = ((const SimJob *)a)->arrival_ns, y = ((const SimJob *)b)->arrival_ns;
+    return (x > y) - (x < y);
+}
+
+// Runs the workload under one policy. Job i of the workload is slot i of
+// the job table, its left-over work is kept in remaining[i].
+static SimResult simulate(SharedState *S, SimJob *w, int n) {
+    SimResult res = { 0, 0, 0, 0 };
+    long long *remaining = malloc(n * sizeof(long long));
+    int *slot_job = malloc(ncpu * sizeof(int));
+    RunQueue *rq = malloc(ncpu * sizeof(RunQueue));
+    if (!remaining || !slot_job || !rq) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < ncpu; i++) {
+        slot_job[i] = -1;
+        runqueue_init(&rq[i]);
+    }
+
+    long long tick_ns = tslice_ms * NS_PER_MS;
+    long long now = EPOCH_NS, next_tick = -1;
+    int arrived = 0, running = 0, slice = 0;
+
+    while (res.ended < n) {
+        // next event: an arrival, a tick or a running job finishing its work
+        long long t = arrived < n ? EPOCH_NS + w[arrived].arrival_ns : -1;
+        if (next_tick >= 0 && (t < 0 || next_tick < t)) t = next_tick;
+        for (int s = 0; s < ncpu; s++) {
+            int idx = slot_job[s];
+            if (idx == -1) continue;
+            long long done = now + (remaining[idx] * 100 + w[idx].share - 1) / w[idx].share;
+            if (t < 0 || done < t) t = done;
+        }
+
+        for (int s = 0; s < ncpu; s++) {
+            int idx = slot_job[s];
+            if (idx == -1) continue;
+            long long used = (t - now) * w[idx].share / 100;
+            if (used > remaining[idx]) used = remaining[idx];
+            remaining[idx] -= used;
+            get_job(S, idx)->user_ns += used;
+        }
+        now = t;
+
+        // exits, reaped right away like reap_children()
+        for (int s = 0; s < ncpu; s++) {
+            int idx = slot_job[s];
+            if (idx == -1 || remaining[idx] > 0) continue;
+            Job *j = get_job(S, idx);
+            slot_job[s] = -1;
+            running--;
+            j->slices_ran++;
+            j->state = DONE;
+            j->completion_ns = now;
+            j->exit_status = 0;
+            res.ended++;
+        }
+
+        // arrivals, set up like check_for_new_jobs()
+        while (arrived < n && EPOCH_NS + w[arrived].arrival_ns <= now) {
+            int idx = arrived++;
+            Job *j = get_job(S, idx);
+            memset(j, 0, sizeof(Job));
+            snprintf(j->name, sizeof(j->name), "job%d", idx);
+            j->pid = idx;
+            j->id = idx + 1;
+            j->state = READY;
+            j->submit_ns = j->ready_since_ns = EPOCH_NS + w[idx].arrival_ns;
+            j->exit_status = -1;
+            j->priority = w[idx].priority;
+            j->last_slot = j->cpu = j->cg_fd = -1;
+            j->threads = 1;
+            remaining[idx] = w[idx].work_ns;
+            S->job_count = arrived;
+            RunQueue *q = &rq[rq_place(S, rq, ncpu)];
+            policy_job_init(S, q, j);
+            enqueue(S, q, idx);
+        }
+
+        // slice boundary, see handle_time_slice()
+        if (now == next_tick) {
+            slice++;
+            for (int s = 0; s < ncpu; s++) {
+                int idx = slot_job[s];
+                if (idx == -1) continue;
+                Job *j = get_job(S, idx);
+                j->slices_ran++;
+                if (--j->slice_left > 0) continue;
+
+                long long ran = j->user_ns - j->cpu_ns;
+                j->cpu_ns = j->user_ns;
+                policy_preempted(S, idx, ran);
+                if (rq[s].nr_ready == 0) {
+                    j->slice_granted = j->slice_left = policy_quantum(S, &rq[s], idx);
+                    j->quantum_sum += j->slice_granted;
+                    continue;
+                }
+                slot_job[s] = -1;
+                running--;
+                j->state = READY;
+                j->ready_since_ns = now;
+                enqueue(S, &rq[s], idx);
+            }
+            policy_slice_end(S, rq, slot_job, ncpu, slice);
+            if (slice % BALANCE_SLICES == 0) rq_balance(S, rq, ncpu);
+            next_tick += tick_ns;
+        }
+
+        // fill free slots from their own run queue, stealing when it is empty
+        for (int s = 0; s < ncpu && S->nr_ready > 0; s++) {
+            if (slot_job[s] != -1) continue;
+            int idx = dequeue(S, &rq[s]);
+            if (idx == -1) idx = rq_steal(S, rq, ncpu, s);
+            if (idx == -1) break;
+            Job *j = get_job(S, idx);
+            if (j->last_slot >= 0 && j->last_slot != s) j->migrations++;
+            slot_job[s] = idx;
+            running++;
+            j->last_slot = s;
+            j->wait_ns += now - j->ready_since_ns;
+            if (!j->started) j->first_run_ns = now;
+            j->started = 1;
+            j->state = RUNNING;
+            j->switches++;
+            j->slice_granted = j->slice_left = policy_quantum(S, &rq[s], idx);
+            j->quantum_sum += j->slice_granted;
+        }
+
+        // the timer only runs while there is something to schedule
+        if (running > 0 || S->nr_ready > 0) {
+            if (next_tick < 0) next_tick = now + tick_ns;
+        } else {
+            next_tick = -1;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        Job *j = get_job(S, i);
+        res.switches += j->switches;
+        res.migrations += j->migrations;
+        if (j->completion_ns - EPOCH_NS > res.makespan_ns) res.makespan_ns = j->completion_ns - EPOCH_NS;
+    }
+    for (int i = 0; i < ncpu; i++) runqueue_destroy(&rq[i]);
+    free(rq);
+    free(remaining);
+    free(slot_job);
+    return res;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <NCPU> <TSLICE(ms)> [rr|mlfq|cfs|all] [adaptive] [report]\n"
+                    "       [trace=<file> | jobs=N arrival=ms burst=ms prio=N io=pct seed=N]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) usage(argv[0]);
+    ncpu = atoi(argv[1]);
+    tslice_ms = atoi(argv[2]);
+    if (ncpu <= 0 || tslice_ms <= 0) usage(argv[0]);
+
+    int policy = -1;          // -1 = compare all policies
+    int adaptive = -1;        // -1 = with and without adaptive quanta
+    int report = 0;
+    int n = 200, prio = 0, io_pct = 0;
+    double arrival_ms = 20, burst_ms = 50;
+    long seed = 1;
+    const char *trace = NULL;
+
+    for (int i = 3; i < argc; i++) {
+        char *a = argv[i];
+        if (strcmp(a, "all") == 0) policy = -1;
+        else if (policy_from_name(a) >= 0) policy = policy_from_name(a);
+        else if (strcmp(a, "adaptive") == 0) adaptive = 1;
+        else if (strcmp(a, "report") == 0) report = 1;
+        else if (strncmp(a, "trace=", 6) == 0) trace = a + 6;
+        else if (strncmp(a, "jobs=", 5) == 0) n = atoi(a + 5);
+        else if (strncmp(a, "arrival=", 8) == 0) arrival_ms = atof(a + 8);
+        else if (strncmp(a, "burst=", 6) == 0) burst_ms = atof(a + 6);
+        else if (strncmp(a, "prio=", 5) == 0) prio = atoi(a + 5);
+        else if (strncmp(a, "io=", 3) == 0) io_pct = atoi(a + 3);
+        else if (strncmp(a, "seed=", 5) == 0) seed = atol(a + 5);
+        else usage(argv[0]);
+    }
+    if (policy >= 0 && adaptive < 0) adaptive = 0;
+    if (prio < 0 || prio > PRIO_MAX) prio = PRIO_MAX;
+
+    SimJob *w;
+    if (trace) {
+        w = load_trace(trace, &n);
+        qsort(w, n, sizeof(SimJob), cmp_arrival);
+        printf("Workload: %d jobs from %s\n", n, trace);
+    } else {
+        w = generate(n, arrival_ms, burst_ms, prio, io_pct, seed);
+        printf("Workload: %d jobs, mean arrival %.1f ms, mean burst %.1f ms, prio +-%d, %d%% I/O-bound, seed %ld\n",
+               n, arrival_ms, burst_ms, prio, io_pct, seed);
+    }
+    if (n <= 0) return 1;
+    printf("%d CPUs, TSLICE %d ms\n\n", ncpu, tslice_ms);
+
+    SharedState *S = calloc(1, sizeof(SharedState));
+    if (!S || job_table_init(S) < 0) return 1;
+    // one slot per job, nothing is recycled
+    if (ftruncate(S->job_fd, (off_t)n * sizeof(Job)) < 0) {
+        perror("ftruncate");
+        return 1;
+    }
+    S->job_capacity = n;
+
+    printf("%-14s %10s %8s %10s %10s %10s %10s %10s %9s %10s %10s\n", "Policy", "Makespan", "Jobs/s",
+           "Turn mean", "Turn p99", "Wait mean", "Wait p99", "Resp mean", "Switches", "Migrations", "Sim time");
+
+    for (int p = POLICY_RR; p <= POLICY_CFS; p++) {
+        if (policy >= 0 && p != policy) continue;
+        for (int ad = 0; ad <= 1; ad++) {
+            if (adaptive >= 0 && ad != adaptive) continue;
+
+            policy_init(S, p, ad, ncpu, tslice_ms);
+            S->job_count = 0;
+            long long t0 = monotonic_ns();
+            SimResult r = simulate(S, w, n);
+            long long sim_ns = monotonic_ns() - t0;
+
+            Summary turnaround, wait, response;
+            report_summary(S, tslice_ms, &turnaround, &wait, &response);
+
+            char name[32];
+            snprintf(name, sizeof(name), "%s%s", policy_name(p), ad ? "+adaptive" : "");
+            printf("%-14s %8.3f s %8.2f %7.1f ms %7.1f ms %7.1f ms %7.1f ms %7.1f ms %9lld %10lld %7.1f ms\n",
+                   name, r.makespan_ns / 1e9, r.ended / (r.makespan_ns / 1e9),
+                   turnaround.mean, turnaround.p99, wait.mean, wait.p99, response.mean,
+                   r.switches, r.migrations, sim_ns / 1e6);
+            if (report) print_report(S, tslice_ms);
+        }
+    }
+
+    job_table_destroy(S);
+    free(S);
+    free(w);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "loader.h"
+#include <time.h>
 
 int fd = -1;
 
@@ -22,6 +23,9 @@ void loader_cleanup() {
  * Load and run the ELF executable file
  */
 void load_and_run_elf(char** exe) {
+  struct timespec t_begin, t_loaded, t_end;
+  clock_gettime(CLOCK_MONOTONIC, &t_begin);
+
   // 1. Load entire binary content into the memory from the ELF file.
   fd = open(exe[1], O_RDONLY);
 
@@ -87,9 +91,18 @@ void load_and_run_elf(char** exe) {
       int (*_start)() = (int (*)())entry_point;
 
       // 6. Call the "_start" method and print the value returned from the "_start"
+      clock_gettime(CLOCK_MONOTONIC, &t_loaded);
       int result = _start();
+      clock_gettime(CLOCK_MONOTONIC, &t_end);
       printf("User _start return value = %d\n", result);
 
+      // everything is loaded eagerly, so load time and time to _start are the same
+      if (getenv("LOADER_BENCH")) {
+        long long load_ns = (t_loaded.tv_sec - t_begin.tv_sec) * 1000000000LL + (t_loaded.tv_nsec - t_begin.tv_nsec);
+        long long run_ns = (t_end.tv_sec - t_begin.tv_sec) * 1000000000LL + (t_end.tv_nsec - t_begin.tv_nsec);
+        printf("BENCH load_ns=%lld start_ns=%lld run_ns=%lld faults=0 hist=\n", load_ns, load_ns, run_ns);
+      }
+
       break;
     }
   }
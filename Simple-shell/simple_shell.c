@@ -1,54 +1,194 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 #include <time.h>
 
+extern char **environ;
+
 #define MAX_LINE 1024
-#define MAX_HISTORY 100
 
+// one process of a command line
 typedef struct {
-    char *command;
     pid_t pid;
-    time_t start_time;
-    time_t end_time;
+    int status;             // wait status, -1 while running
+    long long end_ns;       // CLOCK_MONOTONIC when it was reaped
+    struct rusage usage;    // from wait4()
+} Stage;
+
+typedef struct {
+    char *command;          // command and stages live in history_arena
+    pid_t pid;              // process group, the pid of the first stage
+    time_t start_time;      // wall clock, for display
+    long long start_ns;     // CLOCK_MONOTONIC
+    long long end_ns;       // 0 while running
+    int nr_stages;
+    Stage *stages;
+    int loaded;             // read from the history file, not run by this shell
+    size_t off, size;       // block in the arena
 } History;
 
-History history[MAX_HISTORY];
-int history_count = 0;
+// History is a ring of the newest HISTORY_SIZE entries, numbered 1, 2, ...
+// for the whole session. Each entry's stages and command string are one
+// block of a ring arena; the oldest entries are dropped when either ring
+// is full. The complete history is appended to the history file.
+#define HISTORY_SIZE 4096
+#define ARENA_SIZE (1 << 20)
+#define HIST_FLUSH 32           // entries buffered before the file is written
+
+History history[HISTORY_SIZE];
+long history_first = 1;         // oldest entry still in the ring
+long history_next = 1;          // number of the next entry
+_Alignas(16) char history_arena[ARENA_SIZE];
+size_t arena_head = 0;
+
+int hist_fd = -1;               // history file, O_APPEND
+char hist_buf[65536];           // whole lines not yet written to it
+size_t hist_buf_len = 0;
+int hist_unsaved = 0;
+
+// command name -> absolute path, like bash's `hash`
+#define HASH_BUCKETS 64
+
+typedef struct HashEntry {
+    char *name;
+    char *path;
+    int hits;
+    struct HashEntry *next;
+} HashEntry;
+
+HashEntry *cmd_hash[HASH_BUCKETS];
+char *hashed_path_env = NULL;    // $PATH the table was filled with
+
+// bytes asked for every pipeline pipe with F_SETPIPE_SZ, 0 = kernel default
+int pipe_size = 1 << 20;
+
+// a built-in `tee` stage, run by a thread of the shell
+typedef struct {
+    int in, out, file;
+} TeeStage;
+
+// a `history` stage: the listing, taken when the pipeline starts, and the
+// fd a thread of the shell writes it to
+typedef struct {
+    int out;
+    char *buf;
+    size_t len;
+} HistoryStage;
+
+// A command line that was started, foreground or background. Every job
+// is a process group of its own, led by its first stage.
+#define MAX_JOBS 64
+
+typedef struct {
+    int id;             // [id] shown to the user, 0 = free slot
+    long seq;           // start order, the newest job is the default for fg/bg
+    pid_t pgid;
+    pid_t *pids;        // one per stage, 0 once reaped
+    int nr_pids;
+    int nr_live;
+    int stopped;
+    int background;
+    long hist;          // history entry number
+    char *command;
+} Job;
+
+Job jobs[MAX_JOBS];
+long job_seq = 0;
+
+// Children are reaped by the SIGCHLD handler into this ring, with the
+// time they were reaped; the main loop applies them to the job table
+// with SIGCHLD blocked.
+#define REAP_RING 256
+
+typedef struct {
+    pid_t pid;
+    int status;
+    long long when_ns;
+    struct rusage usage;
+} Reaped;
+
+Reaped reaped[REAP_RING];
+volatile sig_atomic_t reap_head = 0;   // advanced by the handler only
+int reap_tail = 0;
+
+sigset_t chld_set;       // just SIGCHLD
+sigset_t orig_mask;      // signal mask the shell was started with
+int shell_tty = 0;       // interactive: jobs get the terminal in turn
+pid_t shell_pgid;
 
 
 void parse_command(char *line, char **args);
-int launch(char **args, char *line);
-int create_process_and_run(char **args, char *line);
-void pipe_handler(char *line);
-void add_history(char *command, pid_t pid, time_t start_time, time_t end_time);
+int launch(char **args, char *line, int background);
+int create_process_and_run(char **args, char *line, int background);
+void pipe_handler(char *line, int background);
+long add_history(char *command, pid_t *pids, int n, time_t start_time, long long start_ns);
+History *history_entry(long seq);
+void load_history(void);
+void save_history(void);
+void history_builtin(char **args);
+void history_list(FILE *f, char **args);
 void print_report();
+int export_report(const char *path);
+int spawn_command(char **args, int in_fd, int out_fd, int err_fd, pid_t pgid, int take_tty, pid_t *pid);
+void init_job_control(void);
+void update_jobs(void);
+void jobs_builtin(char **args);
+void fg_builtin(char **args);
+void bg_builtin(char **args);
+void wait_builtin(char **args);
+void parallel_builtin(char **args);
+const char *command_path(const char *name);
+void hash_forget(const char *name);
+void hash_builtin(char **args);
+void export_builtin(char **args);
+void pipesize_builtin(char **args);
+void launch_bench(char **args);
 void my_handler(int signum);
+int strip_background(char *line);
+long long now_ns(void);
 int main() {
     char input_line[MAX_LINE];
+    char command[MAX_LINE];
     char *args[MAX_LINE/2 + 1];
     struct sigaction sig;
     memset(&sig, 0, sizeof(sig));
     sig.sa_handler = my_handler;
     sigaction(SIGINT, &sig, NULL);   // now handle Ctrl+C
+    init_job_control();
+    load_history();
     while (1) {
+        update_jobs();
         printf("user@assignment-2:~$ ");
         fflush(stdout);
-        fgets(input_line, MAX_LINE, stdin);
 
-        if (strncmp(input_line, "history", 7) == 0) {
-            for (int i = 0; i < history_count; i++) {
-                printf("%d: %s\n", i + 1, history[i].command);
-            }
-            continue;
+        // children may only be reaped while the shell is idle or waiting
+        sigprocmask(SIG_UNBLOCK, &chld_set, NULL);
+        char *got = fgets(input_line, MAX_LINE, stdin);
+        sigprocmask(SIG_BLOCK, &chld_set, NULL);
+        if (got == NULL) {
+            print_report();
+            save_history();
+            break;
         }
 
-        if (strchr(input_line, '|') != NULL) {
-            pipe_handler(input_line);
+        int background = strip_background(input_line);
+        strcpy(command, input_line);
+
+        if (strpbrk(input_line, "|<>") != NULL) {
+            pipe_handler(input_line, background);
             continue;
         }
 
@@ -60,10 +200,70 @@ int main() {
 
         if (strcmp(args[0], "exit") == 0) {
             print_report();
+            save_history();
             break;
         }
 
-        launch(args, input_line);
+        if (strcmp(args[0], "history") == 0) {
+            history_builtin(args);
+            continue;
+        }
+
+        if (strcmp(args[0], "hash") == 0) {
+            hash_builtin(args);
+            continue;
+        }
+
+        if (strcmp(args[0], "export") == 0) {
+            export_builtin(args);
+            continue;
+        }
+
+        if (strcmp(args[0], "pipesize") == 0) {
+            pipesize_builtin(args);
+            continue;
+        }
+
+        if (strcmp(args[0], "report") == 0) {
+            if (args[1] == NULL) {
+                print_report();
+            } else {
+                export_report(args[1]);
+            }
+            continue;
+        }
+
+        if (strcmp(args[0], "launchbench") == 0) {
+            launch_bench(args);
+            continue;
+        }
+
+        if (strcmp(args[0], "jobs") == 0) {
+            jobs_builtin(args);
+            continue;
+        }
+
+        if (strcmp(args[0], "fg") == 0) {
+            fg_builtin(args);
+            continue;
+        }
+
+        if (strcmp(args[0], "bg") == 0) {
+            bg_builtin(args);
+            continue;
+        }
+
+        if (strcmp(args[0], "parallel") == 0) {
+            parallel_builtin(args);
+            continue;
+        }
+
+        if (strcmp(args[0], "wait") == 0) {
+            wait_builtin(args);
+            continue;
+        }
+
+        launch(args, command, background);
     }
 
     return 0;
@@ -72,10 +272,24 @@ int main() {
 void my_handler(int signum) {
     if (signum == SIGINT) {
         print_report();
+        save_history();
         exit(0);
     }
 }
 
+// Remove the newline and a trailing '&' from line, returns 1 if there was one
+int strip_background(char *line) {
+    int len = strcspn(line, "\n");
+    while (len > 0 && line[len - 1] == ' ') len--;
+    int background = len > 0 && line[len - 1] == '&';
+    if (background) {
+        len--;
+        while (len > 0 && line[len - 1] == ' ') len--;
+    }
+    line[len] = '\0';
+    return background;
+}
+
 void parse_command(char *line, char **args) {
     
     int length = strlen(line);
@@ -96,36 +310,605 @@ void parse_command(char *line, char **args) {
     args[i] = NULL;
 }
 
-int launch(char **args, char *line) {
+int launch(char **args, char *line, int background) {
     int status;
-    status = create_process_and_run(args, line);
+    status = create_process_and_run(args, line, background);
     return status;
 }
 
-int create_process_and_run(char **args, char *line) {
+static unsigned hash_name(const char *name) {
+    unsigned h = 5381;
+    while (*name) {
+        h = h * 33 + (unsigned char)*name++;
+    }
+    return h % HASH_BUCKETS;
+}
+
+static void hash_clear(void) {
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        while (cmd_hash[i] != NULL) {
+            HashEntry *e = cmd_hash[i];
+            cmd_hash[i] = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+    }
+}
+
+void hash_forget(const char *name) {
+    HashEntry **p = &cmd_hash[hash_name(name)];
+    while (*p != NULL) {
+        if (strcmp((*p)->name, name) == 0) {
+            HashEntry *e = *p;
+            *p = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            return;
+        }
+        p = &(*p)->next;
+    }
+}
+
+// first executable regular file called name in $PATH, like execvp()
+static char *search_path(const char *name, const char *path_env) {
+    char buf[4096];
+    const char *dir = path_env;
+    while (1) {
+        const char *end = strchrnul(dir, ':');
+        int len = end - dir;
+        if (len == 0) {
+            snprintf(buf, sizeof(buf), "./%s", name);   // empty entry = cwd
+        } else {
+            snprintf(buf, sizeof(buf), "%.*s/%s", len, dir, name);
+        }
+
+        struct stat st;
+        if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) && access(buf, X_OK) == 0) {
+            return strdup(buf);
+        }
+        if (*end == '\0') {
+            return NULL;
+        }
+        dir = end + 1;
+    }
+}
+
+// Path to exec for a command. Names with a '/' are used as given, others
+// are looked up in the hash table, which is flushed when $PATH changed.
+// The result stays valid until the entry is forgotten.
+const char *command_path(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        path_env = "/bin:/usr/bin";
+    }
+    if (hashed_path_env == NULL || strcmp(hashed_path_env, path_env) != 0) {
+        hash_clear();
+        free(hashed_path_env);
+        hashed_path_env = strdup(path_env);
+    }
+
+    unsigned b = hash_name(name);
+    for (HashEntry *e = cmd_hash[b]; e != NULL; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    char *found = search_path(name, path_env);
+    if (found == NULL) {
+        return NULL;
+    }
+    HashEntry *e = malloc(sizeof(HashEntry));
+    e->name = strdup(name);
+    e->path = found;
+    e->hits = 1;
+    e->next = cmd_hash[b];
+    cmd_hash[b] = e;
+    return e->path;
+}
+
+// hash: list the table, hash -r: empty it
+void hash_builtin(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "-r") == 0) {
+        hash_clear();
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        for (HashEntry *e = cmd_hash[i]; e != NULL; e = e->next) {
+            printf("%4d\t%s\n", e->hits, e->path);
+        }
+    }
+}
+
+// export NAME=value ...
+void export_builtin(char **args) {
+    for (int i = 1; args[i] != NULL; i++) {
+        char *eq = strchr(args[i], '=');
+        if (eq == NULL || eq == args[i]) {
+            fprintf(stderr, "export: usage: export NAME=value\n");
+            continue;
+        }
+        *eq = '\0';
+        setenv(args[i], eq + 1, 1);
+        *eq = '=';
+    }
+}
+
+// Start args[0] with stdin/stdout/stderr taken from in_fd/out_fd/err_fd
+// (-1 = inherit).
+// posix_spawnp lets libc use vfork/clone(CLONE_VM) instead of copying the
+// shell's page tables like fork() does. The child joins process group
+// pgid (0 = a new one, -1 = stay in the shell's) and with take_tty
+// becomes the terminal's foreground group. Returns 0 or an errno value.
+int spawn_command(char **args, int in_fd, int out_fd, int err_fd, pid_t pgid, int take_tty, pid_t *pid) {
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    if (pgid >= 0) {
+        posix_spawnattr_setpgroup(&attr, pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    // undo what the shell blocks and ignores for job control
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGTTOU);
+    posix_spawnattr_setsigmask(&attr, &orig_mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, flags);
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    if (take_tty) {
+        // before the dup2s, while fd 0 is still the terminal
+        posix_spawn_file_actions_addtcsetpgrp_np(&fa, STDIN_FILENO);
+    }
+    if (in_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO);
+    }
+    if (err_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&fa, err_fd, STDERR_FILENO);
+    }
+
+    // exec the cached path directly; a stale entry (binary moved or
+    // deleted) is dropped and the command resolved once more
+    int err = ENOENT;
+    const char *path = command_path(args[0]);
+    if (path != NULL) {
+        err = posix_spawn(pid, path, &fa, &attr, args, environ);
+    }
+    if (err == ENOENT && path != NULL && strchr(args[0], '/') == NULL) {
+        hash_forget(args[0]);
+        path = command_path(args[0]);
+        if (path != NULL) {
+            err = posix_spawn(pid, path, &fa, &attr, args, environ);
+        }
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    return err;
+}
+
+// Reap every child that changed state into the ring, as long as it has
+// room. Runs in the SIGCHLD handler, or with SIGCHLD blocked.
+static void reap_children(void) {
+    while (reap_head - reap_tail < REAP_RING) {
+        Reaped *r = &reaped[reap_head % REAP_RING];
+        pid_t pid = wait4(-1, &r->status, WNOHANG | WUNTRACED | WCONTINUED, &r->usage);
+        if (pid <= 0) break;
+
+        r->pid = pid;
+        r->when_ns = now_ns();
+        reap_head++;
+    }
+}
+
+static void sigchld_handler(int signum) {
+    (void)signum;
+    int saved = errno;
+    reap_children();
+    errno = saved;
+}
+
+void init_job_control(void) {
+    sigemptyset(&chld_set);
+    sigaddset(&chld_set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld_set, &orig_mask);
+    sigdelset(&orig_mask, SIGCHLD);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    // only take part in job control when we own the terminal
+    shell_pgid = getpgrp();
+    shell_tty = isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == shell_pgid;
+    if (shell_tty) {
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+    }
+}
+
+// A free job slot, or -1 after telling the user there is none
+static int free_job_slot(void) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id == 0) return i;
+    }
+    fprintf(stderr, "too many jobs\n");
+    return -1;
+}
+
+static int nr_free_job_slots(void) {
+    int n = 0;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id == 0) n++;
+    }
+    return n;
+}
+
+static void wait_for_job(int slot, int cont);
+
+// Record the n processes just started for line as job `slot`
+static void record_job(int slot, char *line, pid_t *pids, int n, int background,
+                       time_t start_time, long long start_ns) {
+    Job *j = &jobs[slot];
+    j->id = slot + 1;
+    j->seq = ++job_seq;
+    j->pgid = pids[0];
+    j->pids = malloc(n * sizeof(pid_t));
+    memcpy(j->pids, pids, n * sizeof(pid_t));
+    j->nr_pids = n;
+    j->nr_live = n;
+    j->stopped = 0;
+    j->background = background;
+    j->command = strdup(line);
+    j->hist = add_history(line, pids, n, start_time, start_ns);
+}
+
+// Record a job and, in the foreground, wait for it
+static void start_job(int slot, char *line, pid_t *pids, int n, int background,
+                      time_t start_time, long long start_ns) {
+    Job *j = &jobs[slot];
+    record_job(slot, line, pids, n, background, start_time, start_ns);
+
+    if (background) {
+        printf("[%d] %d\n", j->id, j->pgid);
+    } else {
+        wait_for_job(slot, 0);
+    }
+}
+
+static void free_job(Job *j) {
+    free(j->pids);
+    free(j->command);
+    memset(j, 0, sizeof(Job));
+}
+
+// Apply what the SIGCHLD handler reaped to the job table, with SIGCHLD
+// blocked. Finished jobs get their end time in the history; background
+// jobs that finished or stopped are reported.
+void update_jobs(void) {
+    while (1) {
+        reap_children();   // in case the ring was full
+        if (reap_tail == reap_head) break;
+
+        while (reap_tail != reap_head) {
+            Reaped *r = &reaped[reap_tail % REAP_RING];
+            reap_tail++;
+
+            Job *j = NULL;
+            int k = 0;
+            for (int i = 0; i < MAX_JOBS && j == NULL; i++) {
+                if (jobs[i].id == 0) continue;
+                for (k = 0; k < jobs[i].nr_pids; k++) {
+                    if (jobs[i].pids[k] == r->pid) {
+                        j = &jobs[i];
+                        break;
+                    }
+                }
+            }
+            if (j == NULL) continue;
+
+            if (WIFSTOPPED(r->status)) {
+                if (!j->stopped && j->background) {
+                    printf("[%d]  Stopped\t%s\n", j->id, j->command);
+                }
+                j->stopped = 1;
+                continue;
+            }
+            if (WIFCONTINUED(r->status)) {
+                j->stopped = 0;
+                continue;
+            }
+
+            // pids[k] is stage k of the history entry as well
+            j->pids[k] = 0;
+            // the entry may have been dropped from the ring meanwhile
+            History *h = history_entry(j->hist);
+            if (h != NULL) {
+                Stage *st = &h->stages[k];
+                st->status = r->status;
+                st->end_ns = r->when_ns;
+                st->usage = r->usage;
+            }
+            if (--j->nr_live > 0) continue;
+            if (h != NULL) {
+                h->end_ns = r->when_ns;
+            }
+            if (j->background) {
+                printf("[%d]  Done\t%s\n", j->id, j->command);
+            }
+            free_job(j);
+        }
+    }
+}
+
+// Give job `slot` the terminal (resuming it with cont) and wait until it
+// ends or stops. Called with SIGCHLD blocked.
+static void wait_for_job(int slot, int cont) {
+    Job *j = &jobs[slot];
+    int id = j->id;
+
+    if (shell_tty) {
+        tcsetpgrp(STDIN_FILENO, j->pgid);
+    }
+    if (cont) {
+        j->stopped = 0;
+        kill(-j->pgid, SIGCONT);
+    }
+
+    sigset_t wait_mask = orig_mask;
+    while (1) {
+        update_jobs();
+        if (j->id != id || j->stopped) break;
+        sigsuspend(&wait_mask);
+    }
+
+    if (shell_tty) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+    if (j->id == id) {
+        j->background = 1;
+        printf("\n[%d]  Stopped\t%s\n", j->id, j->command);
+    }
+}
+
+// The job named by arg ("2" or "%2"), or the newest one. -1 if none.
+static int find_job(const char *name, const char *arg) {
+    if (arg == NULL) {
+        int best = -1;
+        for (int i = 0; i < MAX_JOBS; i++) {
+            if (jobs[i].id != 0 && (best < 0 || jobs[i].seq > jobs[best].seq)) best = i;
+        }
+        if (best < 0) fprintf(stderr, "%s: no current job\n", name);
+        return best;
+    }
+
+    if (*arg == '%') arg++;
+    char *end;
+    long id = strtol(arg, &end, 10);
+    if (*end != '\0' || id < 1 || id > MAX_JOBS || jobs[id - 1].id == 0) {
+        fprintf(stderr, "%s: %s: no such job\n", name, arg);
+        return -1;
+    }
+    return id - 1;
+}
+
+void jobs_builtin(char **args) {
+    (void)args;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id == 0) continue;
+        printf("[%d]  %-8s %d\t%s\n", jobs[i].id, jobs[i].stopped ? "Stopped" : "Running",
+               jobs[i].pgid, jobs[i].command);
+    }
+}
+
+void fg_builtin(char **args) {
+    int slot = find_job("fg", args[1]);
+    if (slot < 0) return;
+
+    printf("%s\n", jobs[slot].command);
+    jobs[slot].background = 0;
+    wait_for_job(slot, 1);
+}
+
+void bg_builtin(char **args) {
+    int slot = find_job("bg", args[1]);
+    if (slot < 0) return;
+
+    Job *j = &jobs[slot];
+    j->background = 1;
+    if (j->stopped) {
+        j->stopped = 0;
+        kill(-j->pgid, SIGCONT);
+    }
+    printf("[%d]  %s &\n", j->id, j->command);
+}
+
+// wait: until every running job ended, wait <id>: until that one ended.
+// Stopped jobs are not waited for, they would never end.
+void wait_builtin(char **args) {
+    int slot = -1, id = 0;
+    if (args[1] != NULL) {
+        slot = find_job("wait", args[1]);
+        if (slot < 0) return;
+        id = jobs[slot].id;
+    }
+
+    sigset_t wait_mask = orig_mask;
+    while (1) {
+        update_jobs();
+        int busy = 0;
+        for (int i = 0; i < MAX_JOBS; i++) {
+            if (jobs[i].id == 0 || jobs[i].stopped) continue;
+            if (slot < 0 || (i == slot && jobs[i].id == id)) busy = 1;
+        }
+        if (!busy) break;
+        sigsuspend(&wait_mask);
+    }
+}
+
+int create_process_and_run(char **args, char *line, int background) {
     pid_t pid;
-    int status;
-    time_t start_time, end_time;
+    time_t start_time;
+
+    int slot = free_job_slot();
+    if (slot < 0) {
+        return 1;
+    }
 
     time(&start_time);
-    pid = fork();
+    long long start_ns = now_ns();
+    int err = spawn_command(args, -1, -1, -1, 0, shell_tty && !background, &pid);
 
-    if (pid < 0) {
-        perror("fork");
-    } else if (pid == 0) {
-        if (execvp(args[0], args) == -1) {
-            perror("execvp");
-            exit(EXIT_FAILURE);
-        }
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", args[0], strerror(err));
     } else {
-        waitpid(pid, &status, 0);
-        time(&end_time);
-        add_history(line, pid, start_time, end_time);
+        start_job(slot, line, &pid, 1, background, start_time, start_ns);
     }
     return 1;
 }
 
-void pipe_handler(char *line) {
+// Take "< file", "> file" and ">> file" (with or without the space) out
+// of args and open the files in place of in_fd/out_fd, so the command
+// reads and writes them directly. Returns -1 after reporting an error.
+static int redirect(char **args, int *in_fd, int *out_fd) {
+    int j = 0;
+    for (int i = 0; args[i] != NULL; i++) {
+        char *a = args[i];
+        int flags;
+        if (a[0] == '<') {
+            flags = O_RDONLY;
+            a++;
+        } else if (a[0] == '>' && a[1] == '>') {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+            a += 2;
+        } else if (a[0] == '>') {
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+            a++;
+        } else {
+            args[j++] = args[i];
+            continue;
+        }
+
+        if (*a == '\0') {
+            a = args[++i];
+        }
+        if (a == NULL || *a == '\0' || strchr("<>", *a) != NULL) {
+            fprintf(stderr, "syntax error: missing file name\n");
+            return -1;
+        }
+
+        int fd = open(a, flags | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror(a);
+            return -1;
+        }
+        int *target = flags == O_RDONLY ? in_fd : out_fd;
+        if (*target >= 0) close(*target);   // the file replaces the pipe end
+        *target = fd;
+    }
+    args[j] = NULL;
+    return 0;
+}
+
+// `tee file` and `tee -a file` run inside the shell, other forms of tee
+// are left to the real program
+static int is_builtin_tee(char **args) {
+    if (strcmp(args[0], "tee") != 0 || args[1] == NULL) return 0;
+    if (strcmp(args[1], "-a") == 0) return args[2] != NULL && args[3] == NULL;
+    return args[1][0] != '-' && args[2] == NULL;
+}
+
+// move n bytes that are already in pipe `in` to fd, without copying them
+// through user space if the kernel can splice to it
+static int drain(int in, int fd, size_t n) {
+    char buf[65536];
+    while (n > 0) {
+        ssize_t m = splice(in, NULL, fd, NULL, n, SPLICE_F_MOVE);
+        if (m < 0 && errno == EINVAL) {
+            m = read(in, buf, n < sizeof(buf) ? n : sizeof(buf));
+            if (m > 0 && write(fd, buf, m) != m) return -1;
+        }
+        if (m <= 0) return -1;
+        n -= m;
+    }
+    return 0;
+}
+
+// Copy in to both out and file. When in and out are pipes, tee(2)
+// duplicates the data into out and splice(2) moves it on to the file,
+// so the bytes never leave the kernel; otherwise read/write is used.
+static void *tee_stage(void *arg) {
+    TeeStage *t = arg;
+
+    // a reader that quit early should end this stage, not kill the shell
+    sigset_t pipe_sig;
+    sigemptyset(&pipe_sig);
+    sigaddset(&pipe_sig, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_sig, NULL);
+
+    int zero_copy = 1;
+    char buf[65536];
+    while (1) {
+        ssize_t n;
+        if (zero_copy) {
+            n = tee(t->in, t->out, 1 << 20, 0);
+            if (n < 0 && errno == EINVAL) {
+                zero_copy = 0;
+                continue;
+            }
+            if (n > 0 && drain(t->in, t->file, n) < 0) break;
+        } else {
+            n = read(t->in, buf, sizeof(buf));
+            if (n > 0 && (write(t->out, buf, n) != n || write(t->file, buf, n) != n)) break;
+        }
+        if (n <= 0) break;
+    }
+
+    if (t->in != STDIN_FILENO) close(t->in);
+    if (t->out != STDOUT_FILENO) close(t->out);
+    close(t->file);
+    free(t);
+    return NULL;
+}
+
+static void *history_stage(void *arg) {
+    HistoryStage *h = arg;
+
+    sigset_t pipe_sig;
+    sigemptyset(&pipe_sig);
+    sigaddset(&pipe_sig, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_sig, NULL);
+
+    for (size_t off = 0; off < h->len; ) {
+        ssize_t n = write(h->out, h->buf + off, h->len - off);
+        if (n <= 0) break;
+        off += n;
+    }
+
+    if (h->out != STDOUT_FILENO) close(h->out);
+    free(h->buf);
+    free(h);
+    return NULL;
+}
+
+void pipe_handler(char *line, int background) {
     int totalPipes = 0;
     for (int i = 0; line[i] != '\0'; i++) {
         if (line[i] == '|') {
@@ -134,8 +917,13 @@ void pipe_handler(char *line) {
     }
     int n = totalPipes + 1;
 
+    int slot = free_job_slot();
+    if (slot < 0) {
+        return;
+    }
+
     char *line_copy = strdup(line);
-    line_copy[strlen(line_copy) - 1] = '\0';
+    line_copy[strcspn(line_copy, "\n")] = '\0';
 
     char *commands[n];
     char *token = strtok(line, "|");
@@ -147,85 +935,791 @@ void pipe_handler(char *line) {
         commands[idx++] = token;
         token = strtok(NULL, "|");
     }
+    n = idx;
 
+    // close-on-exec, so every stage only keeps the two ends it dup2'd
     int pipes[n-1][2];
     for (int i = 0; i < n-1; i++) {
-        if (pipe(pipes[i]) == -1) {
+        if (pipe2(pipes[i], O_CLOEXEC) == -1) {
             perror("pipe");
             exit(EXIT_FAILURE);
         }
+        if (pipe_size > 0) {
+            // best effort, unprivileged users are capped by fs.pipe-max-size
+            fcntl(pipes[i][1], F_SETPIPE_SZ, pipe_size);
+        }
     }
 
-    time_t start_time, end_time;
+    time_t start_time;
     time(&start_time);
+    long long start_ns = now_ns();
+
+    // fds the shell closes once every stage is started; the ones handed
+    // to a tee thread are closed by that thread
+    int owned[n][2];
+    pthread_t tees[n];   // tee and history stages
+    int nr_tees = 0;
+    pid_t pids[n];
+    int started = 0;
 
     for (int i = 0; i < n; i++) {
-        pid_t pid = fork();
-        if (pid == -1) {
-            perror("fork");
-            exit(EXIT_FAILURE);
+        char *args[MAX_LINE/2 + 1];
+        parse_command(commands[i], args);
+
+        int in_fd = i > 0 ? pipes[i-1][0] : -1;
+        int out_fd = i < n-1 ? pipes[i][1] : -1;
+        int rc = redirect(args, &in_fd, &out_fd);
+        owned[i][0] = in_fd;
+        owned[i][1] = out_fd;
+        if (rc < 0) {
+            continue;
+        }
+        if (args[0] == NULL) {
+            fprintf(stderr, "syntax error: missing command\n");
+            continue;
         }
 
-        if (pid == 0) {
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);
+        if (is_builtin_tee(args)) {
+            // a thread of the shell must not read the terminal for a
+            // background job, a spawned stage would get SIGTTIN instead
+            if (in_fd < 0 && background) {
+                in_fd = owned[i][0] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if (in_fd < 0) {
+                    perror("/dev/null");
+                    continue;
+                }
+            }
+            int append = strcmp(args[1], "-a") == 0;
+            char *file = args[append ? 2 : 1];
+            int fd = open(file, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+            if (fd < 0) {
+                perror(file);
+                continue;
             }
-            if (i < n-1) {
-                dup2(pipes[i][1], STDOUT_FILENO);
+            TeeStage *t = malloc(sizeof(TeeStage));   // freed by the thread
+            t->file = fd;
+            t->in = in_fd >= 0 ? in_fd : STDIN_FILENO;
+            t->out = out_fd >= 0 ? out_fd : STDOUT_FILENO;
+            if (pthread_create(&tees[nr_tees], NULL, tee_stage, t) != 0) {
+                fprintf(stderr, "tee: cannot start\n");
+                close(fd);
+                free(t);
+                continue;
             }
+            owned[i][0] = owned[i][1] = -1;
+            nr_tees++;
+            continue;
+        }
 
-            for (int j = 0; j < n-1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
+        // the listing is taken here, before this pipeline enters the ring;
+        // a thread writes it, so a full pipe cannot block the shell before
+        // the reading stage is started
+        if (strcmp(args[0], "history") == 0) {
+            HistoryStage *h = malloc(sizeof(HistoryStage));   // freed by the thread
+            FILE *mem = h ? open_memstream(&h->buf, &h->len) : NULL;
+            if (mem == NULL) {
+                perror("history");
+                free(h);
+                continue;
+            }
+            history_list(mem, args);
+            fclose(mem);
+            h->out = out_fd >= 0 ? out_fd : STDOUT_FILENO;
+            if (pthread_create(&tees[nr_tees], NULL, history_stage, h) != 0) {
+                fprintf(stderr, "history: cannot start\n");
+                free(h->buf);
+                free(h);
+                continue;
             }
+            owned[i][1] = -1;
+            nr_tees++;
+            continue;
+        }
+
+        // the first stage started leads the job's process group
+        pid_t pgid = started > 0 ? pids[0] : 0;
+        int take_tty = started == 0 && shell_tty && !background;
+        int err = spawn_command(args, in_fd, out_fd, -1, pgid, take_tty, &pids[started]);
+        if (err != 0) {
+            fprintf(stderr, "%s: %s\n", args[0], strerror(err));
+            continue;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (owned[i][0] >= 0) close(owned[i][0]);
+        if (owned[i][1] >= 0) close(owned[i][1]);
+    }
+
+    if (started > 0) {
+        start_job(slot, line_copy, pids, started, background, start_time, start_ns);
+    }
+    for (int i = 0; i < nr_tees; i++) {
+        if (background) {
+            pthread_detach(tees[i]);
+        } else {
+            pthread_join(tees[i], NULL);
+        }
+    }
+    free(line_copy);
+}
+
+// Entry number seq, NULL when it is not (or no longer) in the ring
+History *history_entry(long seq) {
+    if (seq < history_first || seq >= history_next) return NULL;
+    return &history[seq % HISTORY_SIZE];
+}
+
+static void drop_oldest(void) {
+    history_first++;
+}
 
-            char *args[MAX_LINE/2 + 1];
-            parse_command(commands[i], args);
+// Room for size bytes at the arena head. The arena is used in order, so
+// the blocks in the way always belong to the oldest entries.
+static char *arena_alloc(size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    if (arena_head + size > ARENA_SIZE) {
+        // the tail is too short: skip it, dropping the entries still there
+        while (history_first < history_next && history_entry(history_first)->off >= arena_head) {
+            drop_oldest();
+        }
+        arena_head = 0;
+    }
+    size_t end = arena_head + size;
+    while (history_first < history_next) {
+        History *h = history_entry(history_first);
+        if (h->off >= end || h->off + h->size <= arena_head) break;
+        drop_oldest();
+    }
+    char *block = history_arena + arena_head;
+    arena_head = end;
+    return block;
+}
+
+// A new entry with room for n stages, numbered history_next
+static History *new_entry(const char *command, int n) {
+    size_t len = strlen(command) + 1;
+    size_t size = n * sizeof(Stage) + len;
+    if (history_next - history_first == HISTORY_SIZE) {
+        drop_oldest();
+    }
+    char *block = arena_alloc(size);
+
+    History *h = &history[history_next % HISTORY_SIZE];
+    memset(h, 0, sizeof(History));
+    h->off = block - history_arena;
+    h->size = size;
+    h->nr_stages = n;
+    h->stages = (Stage *)block;
+    h->command = block + n * sizeof(Stage);
+    memcpy(h->command, command, len);
+    history_next++;
+    return h;
+}
+
+// Write the buffered lines to the history file, in one append
+void save_history(void) {
+    if (hist_fd >= 0 && hist_buf_len > 0) {
+        if (write(hist_fd, hist_buf, hist_buf_len) < 0) {
+            perror("history file");
+        }
+    }
+    hist_buf_len = 0;
+    hist_unsaved = 0;
+}
+
+// "<start time> <command>" per line, written in batches of HIST_FLUSH
+static void append_history_file(time_t start_time, const char *command) {
+    if (hist_fd < 0) return;
+
+    char line[MAX_LINE + 32];
+    int len = snprintf(line, sizeof(line), "%ld %s\n", (long)start_time, command);
+    if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+    if (hist_buf_len + len > sizeof(hist_buf)) {
+        save_history();
+    }
+    memcpy(hist_buf + hist_buf_len, line, len);
+    hist_buf_len += len;
+    if (++hist_unsaved >= HIST_FLUSH) {
+        save_history();
+    }
+}
+
+// Open the history file ($SIMPLE_SHELL_HISTFILE, else ~/.simple_shell_history)
+// and load its newest entries into the ring
+void load_history(void) {
+    char path[4096];
+    const char *file = getenv("SIMPLE_SHELL_HISTFILE");
+    const char *home = getenv("HOME");
+    if (file == NULL) {
+        if (home == NULL) return;
+        snprintf(path, sizeof(path), "%s/.simple_shell_history", home);
+        file = path;
+    }
 
-            if (execvp(args[0], args) == -1) {
-                perror("execvp failed");
-                exit(EXIT_FAILURE);
+    FILE *f = fopen(file, "r");
+    if (f != NULL) {
+        char line[MAX_LINE + 32];
+        while (fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\n")] = '\0';
+            char *command;
+            long start = strtol(line, &command, 10);
+            if (command == line || *command != ' ') {
+                start = 0;
+                command = line;
+            } else {
+                command++;
             }
+            History *h = new_entry(command, 0);
+            h->start_time = start;
+            h->loaded = 1;
         }
+        fclose(f);
     }
 
-    for (int i = 0; i < n-1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    hist_fd = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (hist_fd < 0) {
+        perror(file);
     }
+}
 
+// Record a command line whose n stages were just started, returns the
+// number of the new entry
+long add_history(char *command, pid_t *pids, int n, time_t start_time, long long start_ns) {
+    History *h = new_entry(command, n);
+    h->pid = pids[0];
+    h->start_time = start_time;
+    h->start_ns = start_ns;
     for (int i = 0; i < n; i++) {
-        wait(NULL);
+        h->stages[i].pid = pids[i];
+        h->stages[i].status = -1;
     }
+    append_history_file(start_time, command);
+    return history_next - 1;
+}
 
-    time(&end_time);
-    add_history(line_copy, getpid(), start_time, end_time);
-    free(line_copy);
+// history: list the ring, history <pattern>: the entries containing
+// pattern, history ^<prefix>: the entries starting with prefix
+void history_builtin(char **args) {
+    history_list(stdout, args);
 }
 
-void add_history(char *command, pid_t pid, time_t start_time, time_t end_time) {
-    if (history_count >= MAX_HISTORY) return;
+void history_list(FILE *f, char **args) {
+    const char *pattern = args[1];
+    int prefix = pattern != NULL && pattern[0] == '^';
+    if (prefix) pattern++;
+    size_t plen = pattern ? strlen(pattern) : 0;
+
+    for (long seq = history_first; seq < history_next; seq++) {
+        const char *command = history_entry(seq)->command;
+        if (pattern != NULL) {
+            if (prefix ? strncmp(command, pattern, plen) != 0 : strstr(command, pattern) == NULL) {
+                continue;
+            }
+        }
+        fprintf(f, "%ld: %s\n", seq, command);
+    }
+}
+
+static double tv_sec(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long long tv_us(struct timeval tv) {
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
 
-    history[history_count].command = strdup(command);
-    history[history_count].pid = pid;
-    history[history_count].start_time = start_time;
-    history[history_count].end_time = end_time;
-    history_count++;
+// "exit 0", "signal 9" or "running"
+static void describe_status(int status, char *buf, size_t len) {
+    if (status == -1) {
+        snprintf(buf, len, "running");
+    } else if (WIFSIGNALED(status)) {
+        snprintf(buf, len, "signal %d", WTERMSIG(status));
+    } else {
+        snprintf(buf, len, "exit %d", WEXITSTATUS(status));
+    }
 }
 
 void print_report() {
     printf("\nExecution Report:\n");
-    for (int i = 0; i < history_count; i++) {
+    for (long seq = history_first; seq < history_next; seq++) {
+        History *h = history_entry(seq);
+        if (h->loaded) continue;
         char start_time[64], end_time[64];
-        struct tm *start = localtime(&history[i].start_time);
-        struct tm *end = localtime(&history[i].end_time);
-        strftime(start_time, sizeof(start_time), "%Y-%m-%d %H:%M:%S", start);
-        strftime(end_time, sizeof(end_time), "%Y-%m-%d %H:%M:%S", end);
+        // localtime() reuses one buffer, format each time before the next call
+        strftime(start_time, sizeof(start_time), "%Y-%m-%d %H:%M:%S", localtime(&h->start_time));
 
-        printf("Command: %s\n", history[i].command);
-        printf("PID: %d\n", history[i].pid);
+        printf("Command: %s\n", h->command);
+        printf("PID: %d\n", h->pid);
         printf("Start: %s\n", start_time);
-        printf("End: %s\n", end_time);
-        printf("Duration: %f seconds\n\n", difftime(history[i].end_time, history[i].start_time));
+        if (h->end_ns == 0) {
+            printf("End: still running\n");
+        } else {
+            time_t end = h->start_time + (h->end_ns - h->start_ns + 500000000) / 1000000000;
+            strftime(end_time, sizeof(end_time), "%Y-%m-%d %H:%M:%S", localtime(&end));
+            printf("End: %s\n", end_time);
+            printf("Duration: %.9f seconds\n", (h->end_ns - h->start_ns) / 1e9);
+        }
+
+        for (int k = 0; k < h->nr_stages; k++) {
+            Stage *st = &h->stages[k];
+            char status[32];
+            describe_status(st->status, status, sizeof(status));
+            printf("  pid %d: %s", st->pid, status);
+            if (st->status != -1) {
+                printf(", user %.6fs, sys %.6fs, max RSS %ld KB, ctx switches %ld vol / %ld invol",
+                       tv_sec(st->usage.ru_utime), tv_sec(st->usage.ru_stime),
+                       st->usage.ru_maxrss, st->usage.ru_nvcsw, st->usage.ru_nivcsw);
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+}
+
+// command lines are user input, quote what CSV and JSON need
+static void put_escaped(FILE *f, const char *s, int json) {
+    for (; *s; s++) {
+        if (json && (*s == '"' || *s == '\\')) fputc('\\', f);
+        if (!json && *s == '"') fputc('"', f);
+        fputc(*s, f);
+    }
+}
+
+static void export_csv(FILE *f) {
+    fprintf(f, "index,command,pgid,start_ns,end_ns,duration_ns,pid,status,exit_code,signal,"
+               "stage_end_ns,user_us,sys_us,maxrss_kb,vol_ctxsw,invol_ctxsw\n");
+    for (long seq = history_first; seq < history_next; seq++) {
+        History *h = history_entry(seq);
+        if (h->loaded) continue;
+        long long duration = h->end_ns ? h->end_ns - h->start_ns : -1;
+        for (int k = 0; k < h->nr_stages; k++) {
+            Stage *st = &h->stages[k];
+            int done = st->status != -1;
+            fprintf(f, "%ld,\"", seq);
+            put_escaped(f, h->command, 0);
+            fprintf(f, "\",%d,%lld,%lld,%lld,%d,%s,%d,%d,%lld,%lld,%lld,%ld,%ld,%ld\n",
+                    h->pid, h->start_ns, h->end_ns, duration, st->pid,
+                    !done ? "running" : WIFSIGNALED(st->status) ? "signaled" : "exited",
+                    done && WIFEXITED(st->status) ? WEXITSTATUS(st->status) : -1,
+                    done && WIFSIGNALED(st->status) ? WTERMSIG(st->status) : 0,
+                    st->end_ns, tv_us(st->usage.ru_utime), tv_us(st->usage.ru_stime),
+                    st->usage.ru_maxrss, st->usage.ru_nvcsw, st->usage.ru_nivcsw);
+        }
     }
-}
\ No newline at end of file
+}
+
+static void export_json(FILE *f) {
+    fprintf(f, "{\n  \"commands\": [");
+    int first = 1;
+    for (long seq = history_first; seq < history_next; seq++) {
+        History *h = history_entry(seq);
+        if (h->loaded) continue;
+        fprintf(f, "%s\n    {\"index\": %ld, \"command\": \"", first ? "" : ",", seq);
+        first = 0;
+        put_escaped(f, h->command, 1);
+        fprintf(f, "\", \"pgid\": %d, \"start_ns\": %lld, \"end_ns\": %lld, \"duration_ns\": %lld,\n"
+                   "     \"stages\": [\n",
+                h->pid, h->start_ns, h->end_ns, h->end_ns ? h->end_ns - h->start_ns : -1);
+        for (int k = 0; k < h->nr_stages; k++) {
+            Stage *st = &h->stages[k];
+            int done = st->status != -1;
+            fprintf(f, "       {\"pid\": %d, \"status\": \"%s\", \"exit_code\": %d, \"signal\": %d, "
+                       "\"end_ns\": %lld, \"user_us\": %lld, \"sys_us\": %lld, \"maxrss_kb\": %ld, "
+                       "\"vol_ctxsw\": %ld, \"invol_ctxsw\": %ld}%s\n",
+                    st->pid, !done ? "running" : WIFSIGNALED(st->status) ? "signaled" : "exited",
+                    done && WIFEXITED(st->status) ? WEXITSTATUS(st->status) : -1,
+                    done && WIFSIGNALED(st->status) ? WTERMSIG(st->status) : 0,
+                    st->end_ns, tv_us(st->usage.ru_utime), tv_us(st->usage.ru_stime),
+                    st->usage.ru_maxrss, st->usage.ru_nvcsw, st->usage.ru_nivcsw,
+                    k + 1 < h->nr_stages ? "," : "");
+        }
+        fprintf(f, "     ]}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+// report file.csv|file.json: write the history with per-stage accounting
+int export_report(const char *path) {
+    const char *ext = strrchr(path, '.');
+    int json = ext && strcmp(ext, ".json") == 0;
+    if (!json && !(ext && strcmp(ext, ".csv") == 0)) {
+        fprintf(stderr, "report: file must end in .csv or .json\n");
+        return -1;
+    }
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    if (json) {
+        export_json(f);
+    } else {
+        export_csv(f);
+    }
+    fclose(f);
+    return 0;
+}
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// one running command of `parallel`; its output is collected and printed
+// in one piece when it is done, so concurrent commands do not mix
+typedef struct {
+    int slot, id;           // job table entry, id 0 = this run is free
+    long hist;              // its history entry
+    int fd[2];              // stdout and stderr pipes, -1 at EOF
+    char *buf[2];
+    size_t len[2], cap[2];
+} ParallelRun;
+
+// args of the template with every "{}" replaced by input, or input appended
+// when the template has no "{}"; the strings are malloc'd
+static int expand_template(char **tmpl, int n, const char *input, char **out) {
+    int used = 0;
+    for (int i = 0; i < n; i++) {
+        const char *mark = strstr(tmpl[i], "{}");
+        if (mark == NULL) {
+            out[i] = strdup(tmpl[i]);
+            continue;
+        }
+        used = 1;
+        size_t len = strlen(tmpl[i]) + strlen(input) * (strlen(tmpl[i]) / 2) + 1;
+        char *a = malloc(len), *o = a;
+        for (const char *c = tmpl[i]; *c; ) {
+            if (c[0] == '{' && c[1] == '}') {
+                o = stpcpy(o, input);
+                c += 2;
+            } else {
+                *o++ = *c++;
+            }
+        }
+        *o = '\0';
+        out[i] = a;
+    }
+    if (!used) {
+        out[n++] = strdup(input);
+    }
+    out[n] = NULL;
+    return n;
+}
+
+// Inputs of `parallel` from a file, or from the shell's stdin for "-"
+static char **read_inputs(const char *file, int *count) {
+    FILE *f = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+    if (f == NULL) {
+        perror(file);
+        return NULL;
+    }
+    char **inputs = NULL;
+    int n = 0, cap = 0;
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            inputs = realloc(inputs, cap * sizeof(char *));
+        }
+        inputs[n++] = strdup(line);
+    }
+    if (f == stdin) {
+        clearerr(stdin);   // the shell keeps reading commands after Ctrl+D
+    } else {
+        fclose(f);
+    }
+    *count = n;
+    return inputs;
+}
+
+// Read what is available from the pipes of run; an fd is closed at EOF
+static void collect_output(ParallelRun *run, struct pollfd *pfd) {
+    for (int s = 0; s < 2; s++) {
+        if (run->fd[s] < 0 || !(pfd[s].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        if (run->cap[s] - run->len[s] < 65536) {
+            run->cap[s] = run->cap[s] * 2 + 65536;
+            run->buf[s] = realloc(run->buf[s], run->cap[s]);
+        }
+        ssize_t n = read(run->fd[s], run->buf[s] + run->len[s], run->cap[s] - run->len[s]);
+        if (n > 0) {
+            run->len[s] += n;
+        } else if (n == 0 || errno != EINTR) {
+            close(run->fd[s]);
+            run->fd[s] = -1;
+        }
+    }
+}
+
+// parallel [-j N] <command> ::: <input>...
+// parallel [-j N] <command> :::: <file>     (one input per line, - = stdin)
+// parallel [-j N] <command>                 (inputs from stdin up to EOF)
+// Runs command once per input, at most N at a time (default: one per CPU).
+void parallel_builtin(char **args) {
+    int max_running = sysconf(_SC_NPROCESSORS_ONLN);
+    int i = 1;
+    if (args[i] != NULL && strncmp(args[i], "-j", 2) == 0) {
+        const char *n = args[i][2] ? &args[i][2] : args[++i];
+        max_running = n ? atoi(n) : 0;
+        if (args[i] != NULL) i++;
+    }
+
+    char **tmpl = &args[i];
+    int ntmpl = 0;
+    while (tmpl[ntmpl] != NULL && strcmp(tmpl[ntmpl], ":::") != 0 && strcmp(tmpl[ntmpl], "::::") != 0) {
+        ntmpl++;
+    }
+    if (ntmpl == 0 || max_running < 1) {
+        fprintf(stderr, "usage: parallel [-j N] <command> [::: <input>... | :::: <file>]\n");
+        return;
+    }
+
+    char **inputs;
+    int ninputs = 0, owned = 0;
+    if (tmpl[ntmpl] != NULL && strcmp(tmpl[ntmpl], ":::") == 0) {
+        inputs = &tmpl[ntmpl + 1];
+        while (inputs[ninputs] != NULL) ninputs++;
+    } else {
+        const char *file = tmpl[ntmpl] != NULL ? tmpl[ntmpl + 1] : "-";
+        if (file == NULL) {
+            fprintf(stderr, "parallel: :::: needs a file\n");
+            return;
+        }
+        inputs = read_inputs(file, &ninputs);
+        owned = 1;
+    }
+
+    // every command is a job, leave some slots for the user's own
+    if (max_running > nr_free_job_slots()) {
+        max_running = nr_free_job_slots();
+    }
+    if (max_running < 1) {
+        fprintf(stderr, "parallel: too many jobs\n");
+        max_running = 0;
+        ninputs = 0;
+    }
+
+    // every command is a process group of its own, like any job, so it is
+    // not in the terminal's foreground group and must not read from it
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    ParallelRun runs[max_running > 0 ? max_running : 1];
+    memset(runs, 0, sizeof(runs));
+    int next = 0, running = 0, failed = 0;
+    sigset_t wait_mask = orig_mask;
+
+    while (next < ninputs || running > 0) {
+        // fill the free runs
+        for (int r = 0; r < max_running && next < ninputs; r++) {
+            if (runs[r].id != 0) continue;
+
+            char *argv[ntmpl + 2];
+            int argc = expand_template(tmpl, ntmpl, inputs[next++], argv);
+            char line[MAX_LINE];
+            line[0] = '\0';
+            for (int a = 0; a < argc; a++) {
+                if (a > 0) strncat(line, " ", sizeof(line) - strlen(line) - 1);
+                strncat(line, argv[a], sizeof(line) - strlen(line) - 1);
+            }
+
+            int out[2] = { -1, -1 }, err[2] = { -1, -1 };
+            pid_t pid;
+            time_t start_time = time(NULL);
+            long long start_ns = now_ns();
+            int rc;
+            if (pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) {
+                rc = errno;
+            } else {
+                rc = spawn_command(argv, null_fd, out[1], err[1], 0, 0, &pid);
+            }
+            if (out[1] >= 0) close(out[1]);
+            if (err[1] >= 0) close(err[1]);
+            for (int a = 0; a < argc; a++) free(argv[a]);
+
+            if (rc != 0) {
+                fprintf(stderr, "%s: %s\n", line, strerror(rc));
+                if (out[0] >= 0) close(out[0]);
+                if (err[0] >= 0) close(err[0]);
+                failed++;
+                r--;   // try the next input in this run
+                continue;
+            }
+            runs[r].slot = free_job_slot();
+            record_job(runs[r].slot, line, &pid, 1, 0, start_time, start_ns);
+            runs[r].id = jobs[runs[r].slot].id;
+            runs[r].hist = jobs[runs[r].slot].hist;
+            runs[r].fd[0] = out[0];
+            runs[r].fd[1] = err[0];
+            runs[r].len[0] = runs[r].len[1] = 0;
+            running++;
+        }
+
+        // print and free the runs whose command ended and whose output is read
+        update_jobs();
+        for (int r = 0; r < max_running; r++) {
+            ParallelRun *run = &runs[r];
+            if (run->id == 0 || jobs[run->slot].id == run->id) continue;
+            if (run->fd[0] >= 0 || run->fd[1] >= 0) continue;
+
+            fwrite(run->buf[0], 1, run->len[0], stdout);
+            fflush(stdout);
+            fwrite(run->buf[1], 1, run->len[1], stderr);
+            History *h = history_entry(run->hist);
+            if (h != NULL && h->stages[0].status != 0) {
+                failed++;
+            }
+            run->id = 0;
+            running--;
+        }
+        if (running == 0) continue;
+
+        // sleep until output arrives or, with SIGCHLD let through, a child ends
+        struct pollfd pfd[2 * max_running];
+        for (int r = 0; r < max_running; r++) {
+            for (int s = 0; s < 2; s++) {
+                pfd[2 * r + s].fd = runs[r].id != 0 ? runs[r].fd[s] : -1;
+                pfd[2 * r + s].events = POLLIN;
+                pfd[2 * r + s].revents = 0;
+            }
+        }
+        if (ppoll(pfd, 2 * max_running, NULL, &wait_mask) > 0) {
+            for (int r = 0; r < max_running; r++) {
+                if (runs[r].id != 0) collect_output(&runs[r], &pfd[2 * r]);
+            }
+        }
+    }
+
+    if (null_fd >= 0) close(null_fd);
+    for (int r = 0; r < max_running; r++) {
+        free(runs[r].buf[0]);
+        free(runs[r].buf[1]);
+    }
+    if (owned) {
+        for (int k = 0; k < ninputs; k++) free(inputs[k]);
+        free(inputs);
+    }
+    if (failed > 0) {
+        fprintf(stderr, "parallel: %d of %d commands failed\n", failed, ninputs);
+    }
+}
+
+// pipesize: show, pipesize <bytes>[k|m]: set the buffer of pipeline pipes
+void pipesize_builtin(char **args) {
+    if (args[1] == NULL) {
+        printf("%d\n", pipe_size);
+        return;
+    }
+    char *end;
+    long size = strtol(args[1], &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size <<= 20;
+        end++;
+    }
+    if (*end != '\0' || size < 0 || size > (1L << 30)) {
+        fprintf(stderr, "pipesize: invalid size '%s'\n", args[1]);
+        return;
+    }
+    pipe_size = size;
+}
+
+// read fd until EOF, then close it
+static void wait_exec(int fd) {
+    char c;
+    ssize_t n;
+    do {
+        n = read(fd, &c, 1);
+    } while (n < 0 && errno == EINTR);
+    close(fd);
+}
+
+// launchbench [-m MB] [N] <cmd> [args]: launch cmd N times with
+// fork+execvp and N times with spawn_command() and print the mean launch
+// latency of each, up to the child's exec. -m grows the shell heap by MB megabytes first, which
+// is what makes fork() slow in a long-running shell.
+void launch_bench(char **args) {
+    int i = 1, runs = 100;
+    size_t ballast_mb = 0;
+    if (args[i] && strcmp(args[i], "-m") == 0 && args[i+1]) {
+        ballast_mb = strtoul(args[i+1], NULL, 10);
+        i += 2;
+    }
+    if (args[i] && args[i][0] >= '0' && args[i][0] <= '9') {
+        runs = atoi(args[i++]);
+    }
+    if (args[i] == NULL || runs < 1) {
+        fprintf(stderr, "usage: launchbench [-m MB] [N] <cmd> [args]\n");
+        return;
+    }
+    char **cmd = &args[i];
+
+    char *ballast = NULL;
+    if (ballast_mb > 0) {
+        ballast = malloc(ballast_mb << 20);
+        if (ballast == NULL) {
+            perror("malloc");
+            return;
+        }
+        memset(ballast, 1, ballast_mb << 20);   // touch it so it is mapped
+    }
+
+    // Both ways are timed from the launch call until the child has exec'd:
+    // the write end of a close-on-exec pipe is closed by the exec (or the
+    // exit of a failed child), so the parent reads EOF at that moment
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    long long fork_ns = 0, spawn_ns = 0;
+    int done = 0;
+    for (; done < runs; done++) {
+        int p[2];
+        if (pipe2(p, O_CLOEXEC) == -1) {
+            perror("pipe2");
+            break;
+        }
+        long long t0 = now_ns();
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(devnull, STDOUT_FILENO);
+            execvp(cmd[0], cmd);
+            _exit(127);
+        }
+        close(p[1]);
+        if (pid < 0) {
+            perror("fork");
+            close(p[0]);
+            break;
+        }
+        wait_exec(p[0]);
+        fork_ns += now_ns() - t0;
+        waitpid(pid, NULL, 0);
+
+        if (pipe2(p, O_CLOEXEC) == -1) {
+            perror("pipe2");
+            break;
+        }
+        t0 = now_ns();
+        int err = spawn_command(cmd, -1, devnull, -1, -1, 0, &pid);
+        close(p[1]);
+        if (err != 0) {
+            fprintf(stderr, "%s: %s\n", cmd[0], strerror(err));
+            close(p[0]);
+            break;
+        }
+        wait_exec(p[0]);
+        spawn_ns += now_ns() - t0;
+        waitpid(pid, NULL, 0);
+    }
+    close(devnull);
+    free(ballast);
+
+    if (done == 0) return;
+    printf("%d launches of %s, heap +%zu MB\n", done, cmd[0], ballast_mb);
+    printf("fork+execvp: %10.1f us/launch\n", fork_ns / 1000.0 / done);
+    printf("posix_spawn: %10.1f us/launch\n", spawn_ns / 1000.0 / done);
+}
@@ -0,0 +1,127 @@
+/*
+ * Benchmark runner for the loaders.
+ * Runs "<loader> <binary>" REPS times with LOADER_BENCH set, parses the
+ * BENCH line the loader prints and reports averaged timings plus the
+ * merged per-fault latency histogram as one row.
+ *
+ * Usage: ./bench <reps> <label> <loader> <binary>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define LAT_BUCKETS 16
+#define OUT_SIZE 4096
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// runs the loader once, fills out with its stdout, returns the wait status
+static int run_once(char *loader, char *binary, char *out, long long *wall_ns) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+
+    long long t0 = now_ns();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        setenv("LOADER_BENCH", "1", 1);
+        char *args[] = { loader, binary, NULL };
+        execv(loader, args);
+        perror("execv");
+        _exit(127);
+    }
+    close(fds[1]);
+
+    int len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], out + len, OUT_SIZE - 1 - len)) > 0) {
+        len += n;
+    }
+    out[len] = '\0';
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    *wall_ns = now_ns() - t0;
+    return status;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 5) {
+        printf("Usage: %s <reps> <label> <loader> <binary>\n", argv[0]);
+        exit(1);
+    }
+
+    int reps = atoi(argv[1]);
+    char *label = argv[2];
+    char *loader = argv[3];
+    char *binary = argv[4];
+    if (reps <= 0) reps = 1;
+
+    char out[OUT_SIZE];
+    long long sum_load = 0, sum_start = 0, sum_run = 0, sum_wall = 0;
+    long long sum_faults = 0;
+    int hist[LAT_BUCKETS] = { 0 };
+    int ok = 0;
+
+    for (int r = 0; r < reps; r++) {
+        long long wall;
+        int status = run_once(loader, binary, out, &wall);
+        char *line = strstr(out, "BENCH ");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !line)
+            continue;
+
+        long long load, start, run;
+        int faults, pos = 0;
+        if (sscanf(line, "BENCH load_ns=%lld start_ns=%lld run_ns=%lld faults=%d hist=%n",
+                   &load, &start, &run, &faults, &pos) != 4)
+            continue;
+
+        // hist is a comma separated list, empty for the eager loader
+        char *h = line + pos;
+        for (int b = 0; b < LAT_BUCKETS && *h >= '0' && *h <= '9'; b++) {
+            hist[b] += strtol(h, &h, 10);
+            if (*h == ',') h++;
+        }
+
+        ok++;
+        sum_load += load;
+        sum_start += start;
+        sum_run += run;
+        sum_wall += wall;
+        sum_faults += faults;
+    }
+
+    printf("%-28s %-8s %3d/%-3d", label, strrchr(loader, '/') ? strrchr(loader, '/') + 1 : loader, ok, reps);
+    if (ok == 0) {
+        printf("  FAILED\n");
+        return 0;
+    }
+    printf(" %10.1f %10.1f %10.3f %10.3f %8.1f  ",
+           sum_load / 1000.0 / ok, sum_start / 1000.0 / ok,
+           sum_run / 1e6 / ok, sum_wall / 1e6 / ok, (double)sum_faults / ok);
+
+    // histogram: "<upper bound in us>:count" for every non empty bucket
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        if (hist[b])
+            printf("<%d:%d ", 2 << b, hist[b]);
+    }
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Loader benchmark: builds synthetic -nostdlib binaries from bench_prog.c
+# and runs both loaders over them through ./bench.
+# Usage: ./bench.sh [reps]   (run through "make bench")
+
+REPS=${1:-5}
+SMART=./loader
+SIMPLE=../Simple-loader/bin/launch
+OUT=bench_bin
+
+mkdir -p $OUT
+
+# name text_pages data_pages bss_pages
+SIZES="small:1:1:1 medium:8:16:64 large:64:128:512"
+# pattern number -> name, 0 is compute only so the eager loader can run it too
+PATTERNS="1:seq 2:stride 3:rand"
+
+build() {
+    gcc -m32 -no-pie -nostdlib -DTEXT_PAGES=$2 -DDATA_PAGES=$3 -DBSS_PAGES=$4 -DPATTERN=$5 \
+        -o $OUT/$1 bench_prog.c || exit 1
+}
+
+printf "%-28s %-8s %-7s %10s %10s %10s %10s %8s  %s\n" \
+    "binary" "loader" "ok" "load(us)" "start(us)" "run(ms)" "wall(ms)" "faults" "fault latency (us:count)"
+
+for size in $SIZES; do
+    IFS=:; set -- $size; unset IFS
+    name=$1; text=$2; data=$3; bss=$4
+
+    build ${name}_none $text $data $bss 0
+    for loader in $SIMPLE $SMART; do
+        ./bench $REPS ${name}_none $loader $OUT/${name}_none
+    done
+
+    for pat in $PATTERNS; do
+        IFS=:; set -- $pat; unset IFS
+        build ${name}_$2 $text $data $bss $1
+        for loader in $SIMPLE $SMART; do
+            ./bench $REPS ${name}_$2 $loader $OUT/${name}_$2
+        done
+    done
+done
@@ -0,0 +1,76 @@
+/*
+ * Synthetic workload for the loader benchmark (see bench.sh).
+ * Built with -nostdlib like fib.c/sum.c. The sizes (in pages) and the
+ * access pattern are chosen on the gcc command line:
+ *   -DTEXT_PAGES=n -DDATA_PAGES=n -DBSS_PAGES=n -DPATTERN=p
+ * PATTERN: 0 = none (compute only), 1 = sequential, 2 = strided, 3 = random
+ */
+#ifndef TEXT_PAGES
+#define TEXT_PAGES 1
+#endif
+#ifndef DATA_PAGES
+#define DATA_PAGES 1
+#endif
+#ifndef BSS_PAGES
+#define BSS_PAGES 1
+#endif
+#ifndef PATTERN
+#define PATTERN 1
+#endif
+
+#define PAGE_INTS 1024
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+// pad .text with TEXT_PAGES pages that are read (never executed) by _start
+__asm__(".pushsection .text\n"
+        ".globl text_pad\n"
+        "text_pad:\n"
+        ".skip " STR(TEXT_PAGES) "*4096\n"
+        ".popsection\n");
+extern const char text_pad[];
+
+int data_arr[DATA_PAGES * PAGE_INTS + 1] = { 1 };
+int bss_arr[BSS_PAGES * PAGE_INTS + 1];
+
+static int touch(volatile int *a, int pages) {
+    int n = pages * PAGE_INTS;
+    int acc = 0;
+    unsigned int x = 12345;
+
+    if (PATTERN == 1) {
+        for (int i = 0; i < n; i++) {
+            a[i] += i;
+            acc += a[i];
+        }
+    } else if (PATTERN == 2) {
+        for (int i = 0; i < n; i += PAGE_INTS) {
+            a[i] += i;
+            acc += a[i];
+        }
+    } else if (PATTERN == 3) {
+        for (int i = 0; i < pages * 4; i++) {
+            x = x * 1103515245 + 12345;
+            int idx = (x >> 8) % n;
+            a[idx] += i;
+            acc += a[idx];
+        }
+    }
+    return acc;
+}
+
+int _start() {
+    int acc = 0;
+
+    if (PATTERN != 0) {
+        for (int i = 0; i < TEXT_PAGES * 4096; i += 4096)
+            acc += ((volatile const char *)text_pad)[i];
+    }
+    acc += touch(data_arr, DATA_PAGES);
+    acc += touch(bss_arr, BSS_PAGES);
+
+    // fixed compute phase so runtime is not just fault handling
+    for (int i = 0; i < 1000000; i++)
+        acc += i & 7;
+    return acc;
+}
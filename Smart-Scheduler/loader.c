@@ -3,10 +3,13 @@
 #include <sys/mman.h> 
 #include <unistd.h>
 #include <errno.h>   
+#include <time.h>
 
 #define PAGE_SIZE 4096
 #define MAX_SEGMENTS 16  
 #define MAX_MAPPED_PAGES 1024
+#define LAT_BUCKETS 16       // bucket 0 is < 2 us, bucket i is [2^i, 2^(i+1)) us
+#define MAX_TRACE 4096
 
 int fd = -1; 
 Elf32_Ehdr ehdr; 
@@ -21,6 +24,108 @@ int num_load_segment = 0;
 void* mapped_pages[MAX_MAPPED_PAGES];
 int num_mapped_pages = 0;
 
+// Benchmark timings, only reported when LOADER_BENCH is set
+struct timespec t_begin;
+long long load_ns = 0;
+long long start_ns = 0;
+int fault_latency_hist[LAT_BUCKETS];
+
+// Per-fault trace, filled by the signal handler and dumped to the
+// LOADER_TRACE file after _start returns. Plain static storage so the
+// handler stays async-signal-safe.
+typedef struct {
+    long long ts_ns;        // fault time relative to t_begin
+    uintptr_t addr;         // faulting address
+    int segment;            // index into load_segment
+    int bytes_read;
+    long long mmap_ns;
+    long long read_ns;      // lseek + read
+    long long service_ns;   // whole handler
+} FaultTrace;
+
+FaultTrace fault_trace[MAX_TRACE];
+int num_fault_trace = 0;
+int dropped_fault_trace = 0;
+
+static long long elapsed_ns(struct timespec *from, struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000LL + (to->tv_nsec - from->tv_nsec);
+}
+
+static void record_fault(struct timespec *fault_begin, uintptr_t addr, int segment,
+                         int bytes_read, long long mmap_ns, long long read_ns) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // first fault is on the entry page, once it is served _start is running
+    if (start_ns == 0)
+        start_ns = elapsed_ns(&t_begin, &now);
+
+    long long service_ns = elapsed_ns(fault_begin, &now);
+    long long us = service_ns / 1000;
+    int b = 0;
+    while (us > 1 && b < LAT_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    fault_latency_hist[b]++;
+
+    if (num_fault_trace == MAX_TRACE) {
+        dropped_fault_trace++;
+        return;
+    }
+    FaultTrace *t = &fault_trace[num_fault_trace++];
+    t->ts_ns = elapsed_ns(&t_begin, fault_begin);
+    t->addr = addr;
+    t->segment = segment;
+    t->bytes_read = bytes_read;
+    t->mmap_ns = mmap_ns;
+    t->read_ns = read_ns;
+    t->service_ns = service_ns;
+}
+
+// writes the trace as CSV and prints a summary of where fault time went
+static void dump_fault_trace(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("fopen trace");
+        return;
+    }
+    fprintf(f, "fault,ts_ns,addr,page,segment,bytes_read,mmap_ns,read_ns,service_ns\n");
+
+    long long seg_service[MAX_SEGMENTS] = { 0 };
+    int seg_faults[MAX_SEGMENTS] = { 0 };
+    long long total_mmap = 0, total_read = 0, total_service = 0;
+
+    for (int i = 0; i < num_fault_trace; i++) {
+        FaultTrace *t = &fault_trace[i];
+        fprintf(f, "%d,%lld,0x%lx,0x%lx,%d,%d,%lld,%lld,%lld\n", i, t->ts_ns,
+                (unsigned long)t->addr, (unsigned long)(t->addr / PAGE_SIZE * PAGE_SIZE),
+                t->segment, t->bytes_read, t->mmap_ns, t->read_ns, t->service_ns);
+        seg_faults[t->segment]++;
+        seg_service[t->segment] += t->service_ns;
+        total_mmap += t->mmap_ns;
+        total_read += t->read_ns;
+        total_service += t->service_ns;
+    }
+    fclose(f);
+
+    printf("--- Page Fault Trace (%d faults, %d dropped) -> %s ---\n",
+           num_fault_trace, dropped_fault_trace, path);
+    printf("Time in handler: %.1f us (mmap %.1f us, lseek/read %.1f us)\n",
+           total_service / 1000.0, total_mmap / 1000.0, total_read / 1000.0);
+    for (int i = 0; i < num_load_segment; i++) {
+        if (seg_faults[i] == 0) continue;
+        printf("Segment %d [0x%x, 0x%x): %d faults, %.1f us\n", i,
+               load_segment[i].p_vaddr, load_segment[i].p_vaddr + load_segment[i].p_memsz,
+               seg_faults[i], seg_service[i] / 1000.0);
+    }
+    printf("Fault latency histogram:\n");
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        if (fault_latency_hist[b] == 0) continue;
+        printf("  %6d - %6d us: %d\n", b ? 1 << b : 0, 2 << b, fault_latency_hist[b]);
+    }
+}
+
 int is_page_mapped(void* page_addr) {
     for (int i = 0; i < num_mapped_pages; i++) {
         if (mapped_pages[i] == page_addr) {
@@ -32,10 +137,14 @@ int is_page_mapped(void* page_addr) {
 
 
 static void signal_handler(int signum, siginfo_t *info, void *parameter) {
+    struct timespec fault_begin;
+    clock_gettime(CLOCK_MONOTONIC, &fault_begin);
+
     total_pageFaults++;
 
     void *fault_addr = info->si_addr;
     Elf32_Phdr *target_phdr = NULL;
+    int segment = -1;
 
     // which segment contains the fault address
     for (int i = 0; i < num_load_segment; i++) {
@@ -43,6 +152,7 @@ static void signal_handler(int signum, siginfo_t *info, void *parameter) {
         if ((uintptr_t)fault_addr >= phdr->p_vaddr && 
             (uintptr_t)fault_addr < phdr->p_vaddr + phdr->p_memsz) {
             target_phdr = phdr;
+            segment = i;
             break;
         }
     }
@@ -56,10 +166,14 @@ static void signal_handler(int signum, siginfo_t *info, void *parameter) {
     uintptr_t align_addr = (addr / PAGE_SIZE) * PAGE_SIZE;
     void *page_start = (void *)align_addr;
 
-    if (is_page_mapped(page_start))
+    if (is_page_mapped(page_start)) {
+        record_fault(&fault_begin, addr, segment, 0, 0, 0);
         return;
+    }
 
     // Allocating page
+    struct timespec t_mmap, t_read, t_read_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_mmap);
     void *page = mmap(page_start, PAGE_SIZE,
                       PROT_READ | PROT_WRITE | PROT_EXEC,
                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
@@ -69,6 +183,8 @@ static void signal_handler(int signum, siginfo_t *info, void *parameter) {
         exit(1);
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &t_read);
+
     total_pageAllocate++;
     mapped_pages[num_mapped_pages++] = page_start;
 
@@ -76,6 +192,7 @@ static void signal_handler(int signum, siginfo_t *info, void *parameter) {
     uintptr_t page_end = align_addr + PAGE_SIZE;
     uintptr_t file_end = target_phdr->p_vaddr + target_phdr->p_memsz;
     uintptr_t read_until;
+    int bytes_read = 0;
         if (align_addr < file_end) {
             if (page_end < file_end) {
                 read_until = page_end;
@@ -90,16 +207,21 @@ static void signal_handler(int signum, siginfo_t *info, void *parameter) {
                 perror("lseek failed");
                 exit(1);
             }
-            if (read(fd, page_start, bytes_needed) <0 ) {
+            bytes_read = read(fd, page_start, bytes_needed);
+            if (bytes_read < 0) {
                 perror("Read failed");
                 exit(1);
             }
     }
+    clock_gettime(CLOCK_MONOTONIC, &t_read_end);
 
     uintptr_t segment_end = target_phdr->p_vaddr + target_phdr->p_memsz;
     if (page_end > segment_end && align_addr < segment_end) {
         total_internal_fragmentation += (page_end - segment_end);
     }
+
+    record_fault(&fault_begin, addr, segment, bytes_read,
+                 elapsed_ns(&t_mmap, &t_read), elapsed_ns(&t_read, &t_read_end));
 }
 
 
@@ -117,6 +239,7 @@ void loader_cleanup() {
 
 
 void load_and_run_elf(char** exe) {
+    clock_gettime(CLOCK_MONOTONIC, &t_begin);
     fd = open(exe[1], O_RDONLY);
 
     if (fd < 0) {
@@ -164,13 +287,33 @@ void load_and_run_elf(char** exe) {
     typedef int (*start_func_t)();
     start_func_t _start = (start_func_t)entry_point;
 
+    struct timespec t_loaded, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_loaded);
+    load_ns = elapsed_ns(&t_begin, &t_loaded);
+
     int result = _start();
+
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
     
     printf("User _start return value = %d\n", result);
     printf("--- SimpleSmartLoader Statistics ---\n");
     printf("Total Page Faults: %d\n", total_pageFaults);
     printf("Total Page Allocations: %d\n", total_pageAllocate);
     printf("Total Internal Fragmentation: %.2f KB\n", (double)total_internal_fragmentation / 1024.0);
+
+    // single machine readable line for the bench runner
+    if (getenv("LOADER_BENCH")) {
+        printf("BENCH load_ns=%lld start_ns=%lld run_ns=%lld faults=%d hist=",
+               load_ns, start_ns, elapsed_ns(&t_begin, &t_end), total_pageFaults);
+        for (int i = 0; i < LAT_BUCKETS; i++) {
+            printf(i ? ",%d" : "%d", fault_latency_hist[i]);
+        }
+        printf("\n");
+    }
+
+    if (getenv("LOADER_TRACE")) {
+        dump_fault_trace(getenv("LOADER_TRACE"));
+    }
 }
 
 int main(int argc, char** argv)